@@ -0,0 +1,99 @@
+#pragma once
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+// Minimum-cost assignment of n rows to m >= n columns by the Hungarian
+// algorithm with potentials, O(n^2 m). The cost matrix and every work
+// buffer are members that keep their capacity, so solving repeatedly at
+// the same or a smaller size does not allocate.
+class min_cost_assignment {
+  private:
+    static constexpr int inf = std::numeric_limits<int>::max() / 2;
+    int n_ = 0;
+    int m_ = 0;
+    std::vector<int> cost_;
+    std::vector<int> u_;
+    std::vector<int> v_;
+    std::vector<int> p_;
+    std::vector<int> way_;
+    std::vector<int> minv_;
+    std::vector<char> used_;
+  public:
+    void resize(int n, int m) {
+      n_ = n;
+      m_ = m;
+      cost_.resize(n * m);
+      u_.resize(n + 1);
+      v_.resize(m + 1);
+      p_.resize(m + 1);
+      way_.resize(m + 1);
+      minv_.resize(m + 1);
+      used_.resize(m + 1);
+    }
+
+    int& cost(int row, int col) {
+      return cost_[row * m_ + col];
+    }
+
+    // Returns the minimum total cost; assigned_column is valid afterwards.
+    int solve() {
+      std::fill(u_.begin(), u_.end(), 0);
+      std::fill(v_.begin(), v_.end(), 0);
+      std::fill(p_.begin(), p_.end(), 0);
+
+      // rows and columns are 1-based below, p_[0] / column 0 is the
+      // row currently being inserted
+      for (int i = 1; i <= n_; i++) {
+        p_[0] = i;
+        int j0 = 0;
+        std::fill(minv_.begin(), minv_.end(), inf);
+        std::fill(used_.begin(), used_.end(), 0);
+        do {
+          used_[j0] = 1;
+          int i0 = p_[j0];
+          int delta = inf;
+          int j1 = 0;
+          for (int j = 1; j <= m_; j++) {
+            if (used_[j]) {
+              continue;
+            }
+            int cur = cost_[(i0 - 1) * m_ + (j - 1)] - u_[i0] - v_[j];
+            if (cur < minv_[j]) {
+              minv_[j] = cur;
+              way_[j] = j0;
+            }
+            if (minv_[j] < delta) {
+              delta = minv_[j];
+              j1 = j;
+            }
+          }
+          for (int j = 0; j <= m_; j++) {
+            if (used_[j]) {
+              u_[p_[j]] += delta;
+              v_[j] -= delta;
+            } else {
+              minv_[j] -= delta;
+            }
+          }
+          j0 = j1;
+        } while (p_[j0] != 0);
+
+        do {
+          int j1 = way_[j0];
+          p_[j0] = p_[j1];
+          j0 = j1;
+        } while (j0);
+      }
+      return -v_[0];
+    }
+
+    int assigned_column(int row) const {
+      for (int j = 1; j <= m_; j++) {
+        if (p_[j] == row + 1) {
+          return j - 1;
+        }
+      }
+      return -1;
+    }
+};
@@ -0,0 +1,81 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Fixed-size, thread-safe memo table. A key maps to one slot in one of
+// NumShards shards, each behind its own mutex, so threads looking up
+// different keys rarely contend. A new key overwrites whatever held its
+// slot, which keeps memory bounded without any eviction bookkeeping. The
+// full key is stored and compared, so a hash collision costs a miss, never
+// a wrong value. Shards allocate their slots on first insert.
+template <class Key, class Value, int NumShards = 64>
+class bounded_cache {
+  private:
+    struct slot {
+      bool used = false;
+      Key key;
+      Value value;
+    };
+
+    struct shard {
+      std::mutex mutex;
+      std::vector<slot> slots;
+    };
+
+    std::size_t slots_per_shard_;
+    mutable std::array<shard, NumShards> shards_;
+    mutable std::atomic<std::uint64_t> hits_{0};
+    mutable std::atomic<std::uint64_t> misses_{0};
+  public:
+    explicit bounded_cache(std::size_t capacity = 1 << 14)
+      : slots_per_shard_(std::max<std::size_t>(1, capacity / NumShards))
+    {
+    }
+
+    bool find(const Key& key, std::size_t hash, Value& value) const {
+      shard& s = shards_[hash % NumShards];
+      {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        if (!s.slots.empty()) {
+          const slot& entry = s.slots[(hash / NumShards) % slots_per_shard_];
+          if (entry.used && entry.key == key) {
+            value = entry.value;
+            hits_.fetch_add(1, std::memory_order_relaxed);
+            return true;
+          }
+        }
+      }
+      misses_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+
+    void insert(const Key& key, std::size_t hash, const Value& value) const {
+      shard& s = shards_[hash % NumShards];
+      std::lock_guard<std::mutex> lock(s.mutex);
+      if (s.slots.empty()) {
+        s.slots.resize(slots_per_shard_);
+      }
+      // assigned member by member so a value that holds memory reuses it
+      slot& entry = s.slots[(hash / NumShards) % slots_per_shard_];
+      entry.used = true;
+      entry.key = key;
+      entry.value = value;
+    }
+
+    std::uint64_t hits() const {
+      return hits_.load(std::memory_order_relaxed);
+    }
+
+    std::uint64_t misses() const {
+      return misses_.load(std::memory_order_relaxed);
+    }
+
+    double hit_rate() const {
+      std::uint64_t total = hits() + misses();
+      return total ? double(hits()) / total : 0;
+    }
+};
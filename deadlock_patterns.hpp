@@ -0,0 +1,199 @@
+#pragma once
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read-only set of local Sokoban deadlock patterns, built offline by
+// sokoban_patterns and memory-mapped, so loading costs a page fault per
+// probe rather than a parse. A pattern is a width x height window of walls
+// and boxes with no goal in it, for which no sequence of pushes gets every
+// box out of the window even if all the floor around the window is free
+// and the player starts anywhere. Any level position that matches one is
+// therefore lost.
+//
+// A window with cells numbered row-major is keyed by
+// (wall bits << cells) | box bits, at most 16 cells so a key fits 32 bits.
+// The file is a header followed by an open-addressing table of keys with
+// linear probing, where 0 marks an empty slot (a pattern has a box).
+class deadlock_patterns {
+  public:
+    struct header {
+      char magic[4];
+      std::uint32_t version;
+      std::uint32_t width;
+      std::uint32_t height;
+      std::uint32_t max_boxes;
+      std::uint32_t table_bits;
+      std::uint64_t count;
+    };
+
+    static constexpr std::uint32_t version = 1;
+    static constexpr int max_cells = 16;
+  private:
+    void* map_ = nullptr;
+    std::size_t map_size_ = 0;
+    const header* header_ = nullptr;
+    const std::uint32_t* table_ = nullptr;
+    std::uint32_t mask_ = 0;
+
+    static std::uint32_t slot_of(std::uint32_t key) {
+      std::uint64_t h = key * 0x9E3779B97F4A7C15ull;
+      return std::uint32_t(h >> 32);
+    }
+  public:
+    // an empty set, which matches nothing
+    deadlock_patterns() = default;
+
+    explicit deadlock_patterns(const std::string& path) {
+      int fd = ::open(path.c_str(), O_RDONLY);
+      if (fd < 0) {
+        throw std::runtime_error("cannot open " + path);
+      }
+      struct stat st;
+      if (::fstat(fd, &st) != 0 || std::size_t(st.st_size) < sizeof(header)) {
+        ::close(fd);
+        throw std::runtime_error(path + " is not a deadlock pattern file");
+      }
+      map_size_ = st.st_size;
+      map_ = ::mmap(nullptr, map_size_, PROT_READ, MAP_SHARED, fd, 0);
+      ::close(fd);
+      if (map_ == MAP_FAILED) {
+        map_ = nullptr;
+        throw std::runtime_error("cannot map " + path);
+      }
+
+      header_ = static_cast<const header*>(map_);
+      std::size_t table_size = std::size_t(1) << header_->table_bits;
+      if (std::memcmp(header_->magic, "SKDP", 4) != 0 || header_->version != version ||
+          header_->width * header_->height > max_cells || header_->table_bits > 31 ||
+          map_size_ != sizeof(header) + table_size * sizeof(std::uint32_t)) {
+        ::munmap(map_, map_size_);
+        map_ = nullptr;
+        throw std::runtime_error(path + " is not a deadlock pattern file");
+      }
+      table_ = reinterpret_cast<const std::uint32_t*>(header_ + 1);
+      mask_ = table_size - 1;
+    }
+
+    deadlock_patterns(const deadlock_patterns&) = delete;
+    deadlock_patterns& operator=(const deadlock_patterns&) = delete;
+
+    ~deadlock_patterns() {
+      if (map_) {
+        ::munmap(map_, map_size_);
+      }
+    }
+
+    bool empty() const {
+      return !header_ || header_->count == 0;
+    }
+
+    int width() const {
+      return header_ ? header_->width : 0;
+    }
+
+    int height() const {
+      return header_ ? header_->height : 0;
+    }
+
+    int max_boxes() const {
+      return header_ ? header_->max_boxes : 0;
+    }
+
+    std::size_t size() const {
+      return header_ ? header_->count : 0;
+    }
+
+    bool contains(std::uint32_t key) const {
+      if (!header_) {
+        return false;
+      }
+      for (std::uint32_t i = slot_of(key) & mask_; ; i = (i + 1) & mask_) {
+        if (table_[i] == key) {
+          return true;
+        }
+        if (table_[i] == 0) {
+          return false;
+        }
+      }
+    }
+
+    // skbn_cfgs/deadlock_patterns.db beside the binary, or the Python
+    // extension, this code was linked into, so it is found from any cwd.
+    static std::string default_path() {
+      std::string module;
+      char exe[PATH_MAX];
+      ssize_t len = ::readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+      if (len > 0) {
+        module.assign(exe, len);
+      }
+      // dladdr names a shared object by path, but the main program only
+      // by argv[0], which /proc/self/exe already resolves
+      Dl_info info;
+      if (::dladdr(reinterpret_cast<void*>(&slot_of), &info) && info.dli_fname &&
+          std::strchr(info.dli_fname, '/')) {
+        if (char* real = ::realpath(info.dli_fname, nullptr)) {
+          module = real;
+          std::free(real);
+        }
+      }
+      std::size_t slash = module.rfind('/');
+      std::string dir = slash == std::string::npos ? "." : module.substr(0, slash);
+      return dir + "/skbn_cfgs/deadlock_patterns.db";
+    }
+
+    // The set the levels use, mapped on first use from $SOKOBAN_PATTERNS
+    // or else default_path(). The patterns only prune, so when the file is
+    // missing or not a pattern set this warns once and the set is empty.
+    static const deadlock_patterns& shared() {
+      static const deadlock_patterns patterns = []() -> deadlock_patterns {
+        const char* env = std::getenv("SOKOBAN_PATTERNS");
+        std::string path = env ? env : default_path();
+        try {
+          return deadlock_patterns(path);
+        } catch (const std::exception& e) {
+          std::cerr << "warning: " << e.what() << ", no deadlock patterns" << std::endl;
+          return deadlock_patterns();
+        }
+      }();
+      return patterns;
+    }
+
+    // Writes keys as a pattern file with the table at most half full.
+    static void write(const std::string& path, int width, int height, int max_boxes,
+        const std::vector<std::uint32_t>& keys) {
+      std::uint32_t bits = 4;
+      while ((std::size_t(1) << bits) < 2 * keys.size()) {
+        bits++;
+      }
+      std::vector<std::uint32_t> table(std::size_t(1) << bits, 0);
+      std::uint32_t mask = table.size() - 1;
+      for (std::uint32_t key : keys) {
+        std::uint32_t i = slot_of(key) & mask;
+        while (table[i] != 0 && table[i] != key) {
+          i = (i + 1) & mask;
+        }
+        table[i] = key;
+      }
+
+      header h{{'S', 'K', 'D', 'P'}, version, std::uint32_t(width), std::uint32_t(height),
+        std::uint32_t(max_boxes), bits, keys.size()};
+      std::ofstream out(path, std::ios::binary);
+      out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+      out.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(std::uint32_t));
+      if (!out) {
+        throw std::runtime_error("cannot write " + path);
+      }
+    }
+};
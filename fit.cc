@@ -0,0 +1,94 @@
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "fit.hpp"
+#include "search.hpp"
+
+// Fits td.py's terminal depth model and nc.py's branching model to the
+// tree_stats summary that search() and v8 write, and gr.py's sibling
+// group model to a raw tree_info dump if one is given, each on its own
+// thread. Both arguments are paths; the summary defaults to ./tree_stats.
+//
+//   fit [tree_stats] [tree_info]
+
+int main(int argc, char** argv) {
+  if (argc > 3) {
+    std::cerr << "usage: " << argv[0] << " [tree_stats] [tree_info]" << std::endl;
+    return 1;
+  }
+  std::string stats_path = argc > 1 ? argv[1] : "tree_stats";
+  std::string info_path = argc > 2 ? argv[2] : "";
+
+  std::ifstream stats_f(stats_path);
+  if (!stats_f) {
+    std::cerr << "cannot open " << stats_path << std::endl;
+    return 1;
+  }
+  tree_stats stats = tree_stats::read(stats_f);
+  const auto& terminals = stats.get_terminal_counts();
+  const auto& arities = stats.get_arity_counts();
+  std::string line;
+
+  // tree_info is read in full before the fits start, so a bad line is
+  // reported without threads to wind down
+  auto start = std::chrono::steady_clock::now();
+  group_regression groups;
+  if (!info_path.empty()) {
+    std::ifstream info_f(info_path);
+    if (!info_f) {
+      std::cerr << "cannot open " << info_path << std::endl;
+      return 1;
+    }
+    std::vector<double> rewards;
+    for (std::size_t line_no = 1; std::getline(info_f, line); line_no++) {
+      auto semi = line.find(';');
+      if (semi == std::string::npos) {
+        continue;
+      }
+      rewards.clear();
+      try {
+        std::stringstream ss(line.substr(0, semi));
+        std::string value;
+        while (std::getline(ss, value, ',')) {
+          rewards.push_back(std::stod(value));
+        }
+        groups.add_group(std::stod(line.substr(semi + 1)), rewards.begin(), rewards.end());
+      } catch (const std::exception&) {
+        std::cerr << info_path << ":" << line_no << ": malformed tree_info line" << std::endl;
+        return 1;
+      }
+    }
+  }
+
+  negative_binomial_fit nb;
+  branching_fit br;
+  std::thread nb_thread([&]() { nb = fit_negative_binomial(terminals); });
+  std::thread br_thread([&]() { br = fit_branching(arities); });
+  nb_thread.join();
+  br_thread.join();
+  auto gr = groups.fit();
+  double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+  std::cout << "terminal depth ~ NB(r, p), " << nb.n << " terminals" << std::endl;
+  std::cout << "  r: " << nb.r << (nb.poisson_limit ? " (Poisson limit)" : "") << std::endl;
+  std::cout << "  p: " << nb.p << std::endl;
+  std::cout << "  log likelihood: " << nb.log_likelihood << std::endl;
+  std::cout << "children ~ floor(N(alpha * depth + beta, sigma)), " << br.n << " nodes" << std::endl;
+  std::cout << "  alpha: " << br.alpha << std::endl;
+  std::cout << "  beta: " << br.beta << std::endl;
+  std::cout << "  sigma: " << br.sigma << std::endl;
+  std::cout << "  log likelihood: " << br.log_likelihood << std::endl;
+  if (!info_path.empty()) {
+    std::cout << "reward ~ N(a_g + b * depth, within_sd), a_g ~ N(a, between_sd), "
+      << gr.groups << " groups, " << gr.n << " rewards" << std::endl;
+    std::cout << "  a: " << gr.a << std::endl;
+    std::cout << "  b: " << gr.b << std::endl;
+    std::cout << "  within_sd: " << gr.within_sd << std::endl;
+    std::cout << "  between_sd: " << gr.between_sd << std::endl;
+  }
+  std::cout << "fitted in " << ms << " ms" << std::endl;
+}
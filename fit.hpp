@@ -0,0 +1,384 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+// Maximum-likelihood fits of the models the analysis scripts estimate,
+// from the summaries search.hpp and v8 write, so they take milliseconds
+// and can run online. Everything works on histograms or streaming sums,
+// never on one record per node.
+
+namespace fit_detail {
+
+inline double digamma(double x) {
+  double result = 0;
+  while (x < 6) {
+    result -= 1 / x;
+    x += 1;
+  }
+  double f = 1 / (x * x);
+  return result + std::log(x) - 0.5 / x -
+    f * (1.0 / 12 - f * (1.0 / 120 - f * (1.0 / 252 - f * (1.0 / 240 - f / 132))));
+}
+
+inline double trigamma(double x) {
+  double result = 0;
+  while (x < 6) {
+    result += 1 / (x * x);
+    x += 1;
+  }
+  double f = 1 / (x * x);
+  return result + 1 / x + f / 2 +
+    f / x * (1.0 / 6 - f * (1.0 / 30 - f * (1.0 / 42 - f / 30)));
+}
+
+// log(Phi(b) - Phi(a)) for a < b, taking the difference in whichever tail
+// keeps precision
+inline double log_normal_interval(double a, double b) {
+  double p;
+  if (a > 0) {
+    p = 0.5 * (std::erfc(a / std::sqrt(2)) - std::erfc(b / std::sqrt(2)));
+  } else {
+    p = 0.5 * (std::erfc(-b / std::sqrt(2)) - std::erfc(-a / std::sqrt(2)));
+  }
+  return std::log(std::max(p, std::numeric_limits<double>::min()));
+}
+
+inline double normal_pdf(double z) {
+  return std::exp(-0.5 * z * z) / std::sqrt(2 * M_PI);
+}
+
+}
+
+// Negative binomial NB(r, p) with P(x) = C(r + x - 1, x) p^r (1 - p)^x, as
+// td.py models terminal depths. r is continuous rather than limited to
+// the integers below the smallest depth.
+struct negative_binomial_fit {
+  double r = 0;
+  double p = 0;
+  double log_likelihood = 0;
+  std::size_t n = 0;
+  // the data are not overdispersed, so the fit is the Poisson limit
+  bool poisson_limit = false;
+};
+
+// counts[x] is how often x was seen. For a fixed r the best p is
+// r / (r + mean), so only the profile likelihood in r is maximised, by
+// Newton's method on log r with digamma and trigamma.
+inline negative_binomial_fit fit_negative_binomial(const std::vector<std::size_t>& counts) {
+  negative_binomial_fit fit;
+  double n = 0;
+  double sum = 0;
+  double sum_sq = 0;
+  for (std::size_t x = 0; x < counts.size(); x++) {
+    n += counts[x];
+    sum += double(x) * counts[x];
+    sum_sq += double(x) * x * counts[x];
+  }
+  fit.n = n;
+  if (n == 0) {
+    return fit;
+  }
+  double mean = sum / n;
+  double var = sum_sq / n - mean * mean;
+
+  auto log_likelihood = [&](double r) {
+    double p = r / (r + mean);
+    double ll = n * (r * std::log(p) + (mean > 0 ? mean * std::log(1 - p) : 0));
+    for (std::size_t x = 0; x < counts.size(); x++) {
+      if (counts[x]) {
+        ll += counts[x] * (std::lgamma(r + x) - std::lgamma(r) - std::lgamma(x + 1.0));
+      }
+    }
+    return ll;
+  };
+
+  const double max_r = 1e8;
+  double r = var > mean ? mean * mean / (var - mean) : max_r;
+  if (var <= mean || r >= max_r) {
+    fit.poisson_limit = true;
+    r = max_r;
+  } else {
+    double ll = log_likelihood(r);
+    for (int iter = 0; iter < 100; iter++) {
+      double d1 = n * (std::log(r / (r + mean)) - fit_detail::digamma(r));
+      double d2 = n * (mean / (r * (r + mean)) - fit_detail::trigamma(r));
+      for (std::size_t x = 0; x < counts.size(); x++) {
+        if (counts[x]) {
+          d1 += counts[x] * fit_detail::digamma(r + x);
+          d2 += counts[x] * fit_detail::trigamma(r + x);
+        }
+      }
+      // derivatives in t = log r
+      double g = r * d1;
+      double h = r * r * d2 + g;
+      double step = h < 0 ? -g / h : (g > 0 ? 1 : -1);
+      step = std::max(-2.0, std::min(2.0, step));
+      double next = r * std::exp(step);
+      double next_ll = log_likelihood(next);
+      while (next_ll < ll && std::abs(step) > 1e-12) {
+        step /= 2;
+        next = r * std::exp(step);
+        next_ll = log_likelihood(next);
+      }
+      if (next_ll < ll) {
+        break;
+      }
+      r = next;
+      ll = next_ll;
+      if (std::abs(step) < 1e-10 || r > max_r) {
+        break;
+      }
+    }
+    if (r > max_r) {
+      fit.poisson_limit = true;
+      r = max_r;
+    }
+  }
+  fit.r = r;
+  fit.p = r / (r + mean);
+  fit.log_likelihood = log_likelihood(r);
+  return fit;
+}
+
+// nc.py's branching model: the child count of a node at depth d is
+// floor(N(alpha * d + beta, sigma)), fitted by maximum likelihood as an
+// interval-censored normal, each count y standing for [y, y + 1).
+struct branching_fit {
+  double alpha = 0;
+  double beta = 0;
+  double sigma = 0;
+  double log_likelihood = 0;
+  std::size_t n = 0;
+};
+
+// counts[d][y] nodes at depth d had y children. Only nodes with children
+// enter the fit, as in nc.py, so a y = 0 column, such as the terminals in
+// an older tree_stats, is ignored. Starts from least squares on y + 1/2
+// and runs Newton's method on (alpha, beta, log sigma) with the exact
+// gradient and a Hessian from differences of it.
+inline branching_fit fit_branching(const std::vector<std::vector<std::size_t>>& counts) {
+  branching_fit fit;
+  struct cell {
+    double depth;
+    double y;
+    double count;
+  };
+  std::vector<cell> cells;
+  double n = 0, sd = 0, sy = 0, sdd = 0, sdy = 0, syy = 0;
+  for (std::size_t d = 0; d < counts.size(); d++) {
+    for (std::size_t y = 1; y < counts[d].size(); y++) {
+      if (counts[d][y]) {
+        double c = counts[d][y];
+        cells.push_back(cell{double(d), double(y), c});
+        double mid = y + 0.5;
+        n += c;
+        sd += c * d;
+        sy += c * mid;
+        sdd += c * d * d;
+        sdy += c * d * mid;
+        syy += c * mid * mid;
+      }
+    }
+  }
+  fit.n = n;
+  if (n == 0) {
+    return fit;
+  }
+
+  using vec = std::array<double, 3>;
+  vec theta;
+  double denom = n * sdd - sd * sd;
+  theta[0] = denom > 0 ? (n * sdy - sd * sy) / denom : 0;
+  theta[1] = (sy - theta[0] * sd) / n;
+  double resid = syy - 2 * theta[0] * sdy - 2 * theta[1] * sy + theta[0] * theta[0] * sdd +
+    2 * theta[0] * theta[1] * sd + n * theta[1] * theta[1];
+  theta[2] = 0.5 * std::log(std::max(resid / n, 1.0 / 12));
+
+  auto log_likelihood = [&](const vec& t) {
+    double sigma = std::exp(t[2]);
+    double ll = 0;
+    for (auto& c : cells) {
+      double mu = t[0] * c.depth + t[1];
+      ll += c.count * fit_detail::log_normal_interval((c.y - mu) / sigma, (c.y + 1 - mu) / sigma);
+    }
+    return ll;
+  };
+  auto gradient = [&](const vec& t) {
+    double sigma = std::exp(t[2]);
+    vec g{0, 0, 0};
+    for (auto& c : cells) {
+      double mu = t[0] * c.depth + t[1];
+      double a = (c.y - mu) / sigma;
+      double b = (c.y + 1 - mu) / sigma;
+      double p = std::exp(fit_detail::log_normal_interval(a, b));
+      double pa = fit_detail::normal_pdf(a);
+      double pb = fit_detail::normal_pdf(b);
+      double d_mu = (pa - pb) / (sigma * p);
+      double d_log_sigma = (a * pa - b * pb) / p;
+      g[0] += c.count * d_mu * c.depth;
+      g[1] += c.count * d_mu;
+      g[2] += c.count * d_log_sigma;
+    }
+    return g;
+  };
+
+  double ll = log_likelihood(theta);
+  for (int iter = 0; iter < 100; iter++) {
+    vec g = gradient(theta);
+    double h[3][3];
+    for (int j = 0; j < 3; j++) {
+      double eps = 1e-5 * std::max(1.0, std::abs(theta[j]));
+      vec up = theta;
+      vec down = theta;
+      up[j] += eps;
+      down[j] -= eps;
+      vec gu = gradient(up);
+      vec gd = gradient(down);
+      for (int i = 0; i < 3; i++) {
+        h[i][j] = (gu[i] - gd[i]) / (2 * eps);
+      }
+    }
+    // solve h * step = -g by Cramer's rule, falling back to gradient ascent
+    // where h is not negative definite
+    double det = h[0][0] * (h[1][1] * h[2][2] - h[1][2] * h[2][1]) -
+      h[0][1] * (h[1][0] * h[2][2] - h[1][2] * h[2][0]) +
+      h[0][2] * (h[1][0] * h[2][1] - h[1][1] * h[2][0]);
+    vec step;
+    bool newton = h[0][0] < 0 && h[0][0] * h[1][1] - h[0][1] * h[1][0] > 0 && det < 0;
+    if (newton) {
+      for (int k = 0; k < 3; k++) {
+        double m[3][3];
+        for (int i = 0; i < 3; i++) {
+          for (int j = 0; j < 3; j++) {
+            m[i][j] = j == k ? -g[i] : h[i][j];
+          }
+        }
+        step[k] = (m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+          m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+          m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0])) / det;
+      }
+    } else {
+      double scale = 1e-3 / n;
+      step = {g[0] * scale, g[1] * scale, g[2] * scale};
+    }
+
+    double size = 1;
+    vec next;
+    double next_ll;
+    do {
+      for (int i = 0; i < 3; i++) {
+        next[i] = theta[i] + size * step[i];
+      }
+      next_ll = log_likelihood(next);
+      size /= 2;
+    } while (next_ll < ll && size > 1e-12);
+    if (next_ll < ll) {
+      break;
+    }
+    double moved = std::abs(next[0] - theta[0]) + std::abs(next[1] - theta[1]) + std::abs(next[2] - theta[2]);
+    theta = next;
+    ll = next_ll;
+    if (newton && moved < 1e-10) {
+      break;
+    }
+  }
+
+  fit.alpha = theta[0];
+  fit.beta = theta[1];
+  fit.sigma = std::exp(theta[2]);
+  fit.log_likelihood = ll;
+  return fit;
+}
+
+// gr.py's per-group reward model, reward = a_g + b * depth + noise, where
+// each sibling group g shares a depth and a random intercept a_g with
+// mean a and spread between_sd, and noise has spread within_sd. Within a
+// group the depth is constant, so a per-group slope is not identifiable
+// from these data and b is shared. Groups are added one at a time and
+// only sums are kept; fit() is weighted least squares of the group means
+// on depth, with the two spreads by the method of moments, which is the
+// maximum-likelihood solution when groups are of equal size.
+class group_regression {
+  private:
+    double groups_ = 0;
+    double n_ = 0;
+    double within_ss_ = 0;
+    // sums over groups of w, w d, w d^2, w m, w d m, w m^2, w = group size
+    double sw_ = 0, swd_ = 0, swdd_ = 0, swm_ = 0, swdm_ = 0, swmm_ = 0;
+    double inverse_sizes_ = 0;
+  public:
+    struct result {
+      double a = 0;
+      double b = 0;
+      double within_sd = 0;
+      double between_sd = 0;
+      std::size_t groups = 0;
+      std::size_t n = 0;
+    };
+
+    template <class It>
+    void add_group(double depth, It begin, It end) {
+      double count = 0;
+      double mean = 0;
+      double m2 = 0;
+      for (It it = begin; it != end; ++it) {
+        count++;
+        double delta = *it - mean;
+        mean += delta / count;
+        m2 += delta * (*it - mean);
+      }
+      if (count == 0) {
+        return;
+      }
+      groups_++;
+      n_ += count;
+      within_ss_ += m2;
+      sw_ += count;
+      swd_ += count * depth;
+      swdd_ += count * depth * depth;
+      swm_ += count * mean;
+      swdm_ += count * depth * mean;
+      swmm_ += count * mean * mean;
+      inverse_sizes_ += 1 / count;
+    }
+
+    void merge(const group_regression& other) {
+      groups_ += other.groups_;
+      n_ += other.n_;
+      within_ss_ += other.within_ss_;
+      sw_ += other.sw_;
+      swd_ += other.swd_;
+      swdd_ += other.swdd_;
+      swm_ += other.swm_;
+      swdm_ += other.swdm_;
+      swmm_ += other.swmm_;
+      inverse_sizes_ += other.inverse_sizes_;
+    }
+
+    result fit() const {
+      result res;
+      res.groups = groups_;
+      res.n = n_;
+      if (groups_ == 0) {
+        return res;
+      }
+      double denom = sw_ * swdd_ - swd_ * swd_;
+      res.b = denom > 0 ? (sw_ * swdm_ - swd_ * swm_) / denom : 0;
+      res.a = (swm_ - res.b * swd_) / sw_;
+
+      double within_var = n_ > groups_ ? within_ss_ / (n_ - groups_) : 0;
+      // weighted residual variance of the group means, which is between
+      // plus within over the group size
+      double resid = swmm_ - 2 * res.a * swm_ - 2 * res.b * swdm_ + res.a * res.a * sw_ +
+        2 * res.a * res.b * swd_ + res.b * res.b * swdd_;
+      double between_var = resid / sw_ - within_var * groups_ / sw_;
+      res.within_sd = std::sqrt(within_var);
+      res.between_sd = std::sqrt(std::max(0.0, between_var));
+      return res;
+    }
+};
@@ -1,13 +1,177 @@
 #pragma once
 
-template <class T, class V>
-class distribution<T> {
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+#include "fit.hpp"
+#include "search.hpp"
+
+// A discrete distribution over values added in increasing order, sampled
+// by inverting its CDF. An empty one samples T(), or min when conditioned.
+template <class T>
+class distribution {
+  private:
+    std::vector<T> values_;
+    std::vector<double> cdf_;
   public:
-    V sample() {
-      return 0;
+    void add(const T& value, double weight) {
+      if (weight > 0) {
+        values_.push_back(value);
+        cdf_.push_back((cdf_.empty() ? 0 : cdf_.back()) + weight);
+      }
+    }
+
+    bool empty() const {
+      return values_.empty();
+    }
+
+    template <class Rng>
+    T sample(Rng& rng) const {
+      if (values_.empty()) {
+        return T();
+      }
+      return sample_at_least(values_.front(), rng);
+    }
+
+    // A sample conditioned on being at least min, or min itself when no
+    // value that large has any weight.
+    template <class Rng>
+    T sample_at_least(const T& min, Rng& rng) const {
+      std::size_t first = std::lower_bound(values_.begin(), values_.end(), min) - values_.begin();
+      if (first == values_.size()) {
+        return min;
+      }
+      double low = first ? cdf_[first - 1] : 0;
+      double u = low + (cdf_.back() - low) * std::generate_canonical<double, 53>(rng);
+      std::size_t i = std::upper_bound(cdf_.begin() + first, cdf_.end(), u) - cdf_.begin();
+      return values_[std::min(i, values_.size() - 1)];
     }
 };
 
+// A surrogate for a game, fitted to the tree statistics of its real play:
+// the terminal depth is negative binomial, a live node at each depth has
+// floor(N(alpha * depth + beta, sigma)) children, at least one, and the
+// reward of the step into each depth is normal with that depth's mean and
+// variance. A rollout from a node samples where the game ends given that
+// it has not ended yet and adds up the expected step rewards on the way,
+// so it costs two table lookups and a normal draw however long the game
+// would run. The rewards do not depend on which child a step takes, so a
+// rollout has no use for the child counts; sample_children is there to
+// grow a synthetic tree from the model, node by node.
 class game_model {
+  private:
+    negative_binomial_fit terminal_fit_;
+    branching_fit branching_fit_;
+    distribution<int> terminal_depth_;
+    // sums of the step reward mean and variance up to each depth
+    std::vector<double> mean_sum_;
+    std::vector<double> var_sum_;
+
+    double sum_to(const std::vector<double>& sums, int depth) const {
+      if (sums.empty() || depth < 0) {
+        return 0;
+      }
+      return sums[std::min<std::size_t>(depth, sums.size() - 1)];
+    }
+  public:
+    game_model() = default;
+
+    explicit game_model(const tree_stats& stats)
+      : terminal_fit_(fit_negative_binomial(stats.get_terminal_counts())),
+        branching_fit_(fit_branching(stats.get_arity_counts()))
+    {
+      if (terminal_fit_.n) {
+        double r = terminal_fit_.r;
+        double p = terminal_fit_.p;
+        // the pmf only falls past the mode, so stop once the tail is
+        // negligible rather than waiting for a rounded total to reach 1
+        double mode = r > 1 ? (r - 1) * (1 - p) / p : 0;
+        double total = 0;
+        for (int x = 0; total < 1 - 1e-12 && x < 1000000; x++) {
+          double pmf = std::exp(std::lgamma(r + x) - std::lgamma(r) - std::lgamma(x + 1.0) +
+            r * std::log(p) + x * std::log1p(-p));
+          if (x > mode && pmf < 1e-15) {
+            break;
+          }
+          terminal_depth_.add(x, pmf);
+          total += pmf;
+        }
+      }
+
+      const auto& rewards = stats.get_reward_stats();
+      double mean = 0;
+      double var = 0;
+      for (auto& r : rewards) {
+        mean += r.mean();
+        var += r.variance();
+        mean_sum_.push_back(mean);
+        var_sum_.push_back(var);
+      }
+    }
 
+    const negative_binomial_fit& get_terminal_fit() const {
+      return terminal_fit_;
+    }
+
+    const branching_fit& get_branching_fit() const {
+      return branching_fit_;
+    }
+
+    bool empty() const {
+      return terminal_depth_.empty();
+    }
+
+    // depth at which a game that is still going at depth ends
+    template <class Rng>
+    int sample_terminal_depth(int depth, Rng& rng) const {
+      if (terminal_depth_.empty()) {
+        return depth;
+      }
+      return terminal_depth_.sample_at_least(depth + 1, rng);
+    }
+
+    // how many children a node that is not terminal has at depth
+    template <class Rng>
+    int sample_children(int depth, Rng& rng) const {
+      double y = branching_fit_.alpha * depth + branching_fit_.beta;
+      if (branching_fit_.sigma > 0) {
+        y += std::normal_distribution<double>(0, branching_fit_.sigma)(rng);
+      }
+      return std::max(1, int(std::floor(y)));
+    }
+
+    // Final total reward of a game that has reward so far and is not over
+    // at depth.
+    template <class Rng>
+    double rollout(int depth, double reward, Rng& rng) const {
+      int end = sample_terminal_depth(depth, rng);
+      double mean = sum_to(mean_sum_, end) - sum_to(mean_sum_, depth);
+      double var = sum_to(var_sum_, end) - sum_to(var_sum_, depth);
+      std::normal_distribution<double> noise(0, std::sqrt(std::max(var, 0.0)));
+      return reward + mean + (var > 0 ? noise(rng) : 0);
+    }
 };
+
+// Plays n uniformly random games from env and records them the way
+// search() records its trees, as material to fit a game_model to.
+template <class Env, class Rng>
+tree_stats sample_rollouts(const Env& env, std::size_t n, Rng& rng) {
+  tree_stats stats;
+  for (std::size_t i = 0; i < n; i++) {
+    Env cur(env);
+    while (true) {
+      auto moves = cur.get_possible_moves();
+      if (cur.is_game_over()) {
+        moves.clear();
+      }
+      stats.add_expansion(cur.get_num_steps(), moves.size());
+      if (moves.empty()) {
+        break;
+      }
+      cur.step(moves[rng() % moves.size()]);
+      stats.add_reward(cur.get_num_steps(), cur.get_curr_reward());
+    }
+  }
+  return stats;
+}
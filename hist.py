@@ -1,7 +1,13 @@
 import matplotlib.pyplot as plt
 
-with open('td') as td:
-    tds = [ int(line[:-1]) for line in td.readlines() ]
+depths = list()
+counts = list()
+with open('tree_stats') as ts:
+    for line in ts:
+        fields = line.split()
+        if fields[0] == 'terminal':
+            depths.append(int(fields[1]))
+            counts.append(int(fields[2]))
 
-plt.hist(tds, 100)
+plt.hist(depths, 100, weights=counts)
 plt.show()
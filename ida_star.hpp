@@ -0,0 +1,275 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Lock-free open-addressing transposition table for iterative deepening.
+// Each slot is one 64-bit word holding the top 40 bits of the state hash,
+// the iteration that wrote it and the best depth it was reached at, so
+// lookups and updates are single loads and compare-and-swaps. Entries from
+// an earlier iteration count as empty, which clears the table between
+// iterations for free. The iteration is kept in 8 bits, so after 255
+// iterations the tags repeat and the table has to be cleared for real.
+class transposition_table {
+  private:
+    static constexpr int probes = 8;
+    std::vector<std::atomic<std::uint64_t>> slots_;
+    std::uint64_t mask_;
+
+    static std::uint64_t pack(std::uint64_t tag, unsigned iteration, unsigned depth) {
+      return (tag << 24) | ((iteration & 0xff) << 16) | (depth & 0xffff);
+    }
+  public:
+    explicit transposition_table(int bits = 22)
+      : slots_(std::size_t(1) << bits),
+        mask_((std::uint64_t(1) << bits) - 1)
+    {
+    }
+
+    // Empties every slot, for when the iteration tags wrap around.
+    void clear() {
+      for (auto& slot : slots_) {
+        slot.store(0, std::memory_order_relaxed);
+      }
+    }
+
+    // Records that the state was reached at depth in this iteration.
+    // Returns true when it was already reached at the same or a smaller
+    // depth, in which case the caller can skip it: that visit searched it
+    // with at least as much budget. iteration must not be 0 modulo 256.
+    bool visit(std::uint64_t hash, unsigned iteration, unsigned depth) {
+      std::uint64_t tag = hash >> 24;
+      std::uint64_t entry = pack(tag, iteration, depth);
+      for (int p = 0; p < probes; p++) {
+        std::atomic<std::uint64_t>& slot = slots_[(hash + p) & mask_];
+        std::uint64_t cur = slot.load(std::memory_order_relaxed);
+        while (true) {
+          bool stale = ((cur >> 16) & 0xff) != (iteration & 0xff);
+          bool same = !stale && (cur >> 24) == tag;
+          if (!stale && !same) {
+            break;
+          }
+          if (same && (cur & 0xffff) <= depth) {
+            return true;
+          }
+          if (slot.compare_exchange_weak(cur, entry, std::memory_order_relaxed)) {
+            return false;
+          }
+        }
+      }
+      // every probed slot holds another state from this iteration
+      slots_[hash & mask_].store(entry, std::memory_order_relaxed);
+      return false;
+    }
+};
+
+// Parallel IDA* over an env with an admissible get_lower_bound() and an
+// is_solved() test, meant for sokoban_push_env, where depth is pushes and
+// the bound is the box/goal matching. Each iteration deepens the cost
+// bound by the smallest f that exceeded it. The states a few pushes below
+// the root are handed to the threads one at a time, and all threads share
+// one transposition table keyed by Env::hash(), so a state reached through
+// different pushes is searched once per iteration. The first solution found
+// has the fewest pushes.
+//
+// The threads do not scale well yet. Every state copy touches the shared
+// level's reference count, and every bound goes through the shared reward
+// cache, so threads contend on both. Speedup past one thread has not been
+// measured, and sokoban_batch runs one search thread per level.
+template <class Env>
+class ida_star {
+  public:
+    using move_type = typename Env::move_type;
+  private:
+    struct frontier_node {
+      Env env;
+      std::vector<move_type> path;
+    };
+
+    static constexpr int infinity = std::numeric_limits<int>::max();
+
+    Env root_;
+    unsigned num_threads_;
+    transposition_table table_;
+    std::atomic<std::size_t> num_nodes_{0};
+    std::size_t num_iterations_ = 0;
+    std::atomic<bool> stop_{false};
+    // polled every few thousand nodes; false stops the search
+    std::function<bool()> keep_going_;
+    std::mutex solution_mutex_;
+    bool solved_ = false;
+    std::vector<move_type> solution_;
+
+    void found(const std::vector<move_type>& path) {
+      std::lock_guard<std::mutex> lock(solution_mutex_);
+      if (!solved_) {
+        solved_ = true;
+        solution_ = path;
+      }
+      stop_ = true;
+    }
+
+    // Depth-first search below the cost bound. Returns the smallest f seen
+    // above the bound, or infinity if the subtree is exhausted.
+    int dfs(const Env& env, int g, int bound, unsigned iteration,
+        std::vector<move_type>& path, std::size_t& nodes) {
+      if (stop_.load(std::memory_order_relaxed)) {
+        return infinity;
+      }
+      int h = env.get_lower_bound();
+      if (h >= Env::level_type::unreachable) {
+        return infinity;
+      }
+      if (g + h > bound) {
+        return g + h;
+      }
+      if (env.is_solved()) {
+        found(path);
+        return infinity;
+      }
+      if (table_.visit(env.hash(), iteration, g)) {
+        return infinity;
+      }
+
+      if (++nodes == 4096) {
+        num_nodes_ += nodes;
+        nodes = 0;
+        if (!keep_going_()) {
+          stop_ = true;
+        }
+      }
+
+      int next_bound = infinity;
+      for (const move_type& move : env.get_possible_moves()) {
+        Env child(env);
+        child.step(move);
+        path.push_back(move);
+        next_bound = std::min(next_bound, dfs(child, g + 1, bound, iteration, path, nodes));
+        path.pop_back();
+      }
+      return next_bound;
+    }
+
+    // The states a few pushes below the root, enough to keep every thread
+    // busy. Solutions that short are found here directly.
+    std::vector<frontier_node> build_frontier() {
+      std::vector<frontier_node> frontier{frontier_node{root_, {}}};
+      std::size_t target = 8 * num_threads_;
+      for (int depth = 0; depth < 3 && frontier.size() < target; depth++) {
+        std::vector<frontier_node> next;
+        for (auto& node : frontier) {
+          if (node.env.is_solved()) {
+            found(node.path);
+            return {};
+          }
+          for (const move_type& move : node.env.get_possible_moves()) {
+            frontier_node child{node.env, node.path};
+            child.env.step(move);
+            child.path.push_back(move);
+            next.push_back(child);
+          }
+        }
+        if (next.empty()) {
+          break;
+        }
+        frontier.swap(next);
+      }
+      return frontier;
+    }
+
+    // Runs iterations until a solution is found, the search space is
+    // exhausted or keep_going() says stop.
+    std::vector<move_type> run(std::function<bool()> keep_going, bool verbose) {
+      keep_going_ = keep_going;
+      std::vector<frontier_node> frontier = build_frontier();
+      if (solved_ || frontier.empty()) {
+        return solution_;
+      }
+
+      int bound = root_.get_lower_bound();
+      while (bound < infinity && !stop_) {
+        num_iterations_++;
+        // tags run 1..255; once they wrap, entries from 255 iterations ago
+        // would look current
+        unsigned iteration = (num_iterations_ - 1) % 255 + 1;
+        if (iteration == 1 && num_iterations_ > 1) {
+          table_.clear();
+        }
+        std::atomic<std::size_t> next(0);
+        std::atomic<int> next_bound(infinity);
+
+        auto work = [&]() {
+          std::vector<move_type> path;
+          std::size_t nodes = 0;
+          for (std::size_t i = next++; i < frontier.size() && !stop_; i = next++) {
+            path = frontier[i].path;
+            int b = dfs(frontier[i].env, path.size(), bound, iteration, path, nodes);
+            int cur = next_bound.load();
+            while (b < cur && !next_bound.compare_exchange_weak(cur, b)) {
+            }
+          }
+          num_nodes_ += nodes;
+        };
+        std::vector<std::thread> workers;
+        for (unsigned t = 1; t < num_threads_; t++) {
+          workers.emplace_back(work);
+        }
+        work();
+        for (auto& worker : workers) {
+          worker.join();
+        }
+
+        if (verbose) {
+          std::cout << "bound: " << bound << " num_nodes: " << num_nodes_ << std::endl;
+        }
+        bound = next_bound;
+        if (!keep_going_()) {
+          break;
+        }
+      }
+      return solution_;
+    }
+  public:
+    ida_star(Env env, unsigned num_threads = std::thread::hardware_concurrency(), int table_bits = 22)
+      : root_(env),
+        num_threads_(std::max(1u, num_threads)),
+        table_(table_bits)
+    {
+      // the rollout cap does not apply to an exact search
+      root_.set_max_moves(Env::no_move_cap);
+    }
+
+    bool is_solved() const {
+      return solved_;
+    }
+
+    std::size_t get_num_nodes() const {
+      return num_nodes_;
+    }
+
+    std::size_t get_num_iterations() const {
+      return num_iterations_;
+    }
+
+    // Counterpart of MCTS::search_aio: renders the root, reports progress
+    // and returns the solution, or an empty sequence if none was found
+    // within max_nodes expanded states.
+    std::vector<move_type> search_aio(std::size_t max_nodes) {
+      root_.render();
+      return run([&]() { return num_nodes_ < max_nodes; }, true);
+    }
+
+    // Counterpart of MCTS::search_for: silent, with a wall-clock budget.
+    std::vector<move_type> search_for(double seconds) {
+      using clock = std::chrono::steady_clock;
+      auto deadline = clock::now() + std::chrono::duration<double>(seconds);
+      return run([&]() { return clock::now() < deadline; }, false);
+    }
+};
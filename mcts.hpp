@@ -1,18 +1,33 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cmath>
 #include <cstdlib>
+#include <ctime>
 #include <iostream>
 #include <limits>
+#include <random>
 #include <set>
 #include <sstream>
+#include <thread>
+#include <type_traits>
 #include <utility>
 #include <vector>
+#include "game_model.hpp"
+#include "mpmc_ring.hpp"
 
 
-static std::size_t node_id = 0;
-static std::set<std::size_t> env_hashes;
+static std::atomic<std::size_t> node_id(0);
+
+// Envs that can play several rollouts at once in lockstep name the batch
+// kernel as Env::batch_type.
+template <class Env, class = void>
+struct has_batch_rollout : std::false_type {};
+
+template <class Env>
+struct has_batch_rollout<Env, std::void_t<typename Env::batch_type>> : std::true_type {};
 
 template <class Env>
 class node {
@@ -21,6 +36,7 @@ class node {
     using children_type = std::vector<node<Env>>;
     using position_type = typename Env::position_type;
     using move_type = typename Env::move_type;
+    using hash_set_type = std::set<std::size_t>;
   private:
     parent_type parent_;
     children_type children_;
@@ -29,18 +45,37 @@ class node {
     std::vector<move_type> moves_;
     bool moves_found_;
     bool is_terminal_;
+    // MCTS-Solver: the subtree is fully explored and solved_value_ is the
+    // best final reward in it, or -infinity when every move led to a state
+    // already elsewhere in the tree. Such moves are not followed, so the
+    // value is exact for the tree rather than for the game.
+    bool is_solved_ = false;
+    double solved_value_ = -std::numeric_limits<double>::infinity();
     double q_;
     double ssq_;
     int n_;
+    // rollouts below this node that a pipelined search has not got back yet
+    int in_flight_ = 0;
     int depth_;
     std::size_t node_id_;
+    // states already in the tree, shared by every node of one search
+    hash_set_type* env_hashes_;
   public:
-    node(move_type action, Env env, parent_type parent)
+    node(move_type action, Env env, parent_type parent, hash_set_type* env_hashes)
       : action_(action), env_(env), parent_(parent), is_terminal_(false),
         q_(0), n_(0), ssq_(0), depth_(parent ? parent->depth_ + 1 : 0), node_id_(node_id++),
-        moves_({}), moves_found_(false)
+        moves_({}), moves_found_(false), env_hashes_(env_hashes)
     {
-      env_hashes.insert(env.hash()); 
+      env_hashes_->insert(env.hash()); 
+      if (env_.is_game_over()) {
+        set_terminal();
+      }
+    }
+
+    void set_terminal() {
+      is_terminal_ = true;
+      is_solved_ = true;
+      solved_value_ = env_.get_total_reward();
     }
 
     std::string to_gv() const {
@@ -58,16 +93,10 @@ class node {
       if (!moves_found_) {
         moves_ = env_.get_possible_moves();
         moves_found_ = true;
-      } 
-
-      if (moves_.empty()) {
-        if (children_.empty()) {
-          is_terminal_ = true;
-          return nullptr;
-        } else {
-          return nullptr; 
+        if (moves_.empty()) {
+          set_terminal();
         }
-      }
+      } 
 
       while (!moves_.empty()) {
         auto move = moves_.back();
@@ -75,10 +104,8 @@ class node {
         Env env(env_);
         env.step(move);
         std::size_t env_hash = env.hash();
-        if (!env_hashes.count(env_hash)) {
-          env_hashes.insert(env_hash);
-          node<Env> child(move, env, this);
-          children_.push_back(child);
+        if (!env_hashes_->count(env_hash)) {
+          children_.emplace_back(move, std::move(env), this, env_hashes_);
           return &(children_.back());
         } 
       }
@@ -86,6 +113,27 @@ class node {
       return nullptr;
     }
 
+    // Solves this node once every move has been expanded and every child is
+    // solved, and says whether it is solved.
+    bool try_solve() {
+      if (is_solved_) {
+        return true;
+      }
+      if (!moves_found_ || !moves_.empty()) {
+        return false;
+      }
+      double best = -std::numeric_limits<double>::infinity();
+      for (auto& child : children_) {
+        if (!child.is_solved_) {
+          return false;
+        }
+        best = std::max(best, child.solved_value_);
+      }
+      is_solved_ = true;
+      solved_value_ = best;
+      return true;
+    }
+
     Env& get_env() {
       return env_;
     }
@@ -106,6 +154,14 @@ class node {
       n_ = value;
     }
 
+    int get_in_flight() const {
+      return in_flight_;
+    }
+
+    void set_in_flight(int value) {
+      in_flight_ = value;
+    }
+
     double get_ssq() const {
       return ssq_;
     }
@@ -134,6 +190,14 @@ class node {
       return is_terminal_;
     }
 
+    bool is_solved() const {
+      return is_solved_;
+    }
+
+    double get_solved_value() const {
+      return solved_value_;
+    }
+
     move_type get_action() const {
       return action_;
     }
@@ -147,35 +211,76 @@ class node {
     }
 };
 
-template <class Env>
+// RolloutPolicy picks the candidate moves of the default policy. It is built
+// from a pointer to the rollout's env and get() returns the moves to choose
+// from uniformly; each env provides rollout_move_getter as the default.
+template <class Env, class RolloutPolicy = typename Env::rollout_move_getter>
 class MCTS {
   public:
     using node_type = node<Env>;
     using position_type = typename Env::position_type;
     using move_type = typename node<Env>::move_type;
   private:
+    typename node_type::hash_set_type env_hashes_;
     node_type root_;
     node_type* cur_;
     std::size_t num_nodes_;
+    std::size_t num_iterations_;
     int high_score_;
     std::vector<move_type> seq_;
+    // the whole game of the best rollout, including the moves played
+    // before the search started, which high_score_moves() leaves out
     std::vector<move_type> high_score_seq_;
+    std::size_t start_steps_;
+    std::mt19937 rng_;
+    bool leaf_parallel_;
+    const game_model* model_ = nullptr;
   public:
-    MCTS(Env env) 
-      : root_(node<Env>{Env::root_state(), env, nullptr}),
+    MCTS(Env env, unsigned seed = time(NULL)) 
+      : root_(node<Env>{Env::root_state(), env, nullptr, &env_hashes_}),
         cur_(&root_),
         num_nodes_(0),
-        high_score_(-99999)
+        num_iterations_(0),
+        high_score_(-99999),
+        start_steps_(env.get_seq().size()),
+        rng_(seed),
+        leaf_parallel_(false)
     {
-      srand(time(NULL)); 
+    }
+
+    // Evaluates each leaf with a full batch of lockstep rollouts instead of
+    // one, backpropagating every result. Only for envs with a batch_type;
+    // the batch follows RolloutPolicy::tabu_color.
+    void set_leaf_parallel(bool value) {
+      static_assert(has_batch_rollout<Env>::value, "Env has no batch rollout kernel");
+      leaf_parallel_ = value;
+    }
+
+    // Evaluates leaves by a rollout of model instead of playing the game
+    // out, or plays again if model is null. The model must outlive the
+    // search. Only real terminals reached by the tree count as high scores.
+    void set_rollout_model(const game_model* model) {
+      model_ = model;
     }
 
     void make_move(node_type* move) {
-      root_ = node_type(move->get_action(), move->get_env(), nullptr);
+      root_ = node_type(move->get_action(), move->get_env(), nullptr, &env_hashes_);
       cur_ = &root_; 
       num_nodes_ = 0;
     }
 
+    std::size_t get_num_iterations() const {
+      return num_iterations_;
+    }
+
+    std::size_t get_num_nodes() const {
+      return num_nodes_;
+    }
+
+    node_type& get_root() {
+      return root_;
+    }
+
     std::string to_gv() const {
       std::stringstream ss;
       ss << "graph {" << std::endl;
@@ -186,16 +291,22 @@ class MCTS {
 
     double UCB1(node_type* cur) {
       int n = cur->get_n();
-      if (n == 0) {
+      // rollouts in flight count as visits that have not moved the mean,
+      // or as zero rewards before any has come back (a virtual loss), so
+      // a pipelined search spreads out over the tree
+      int visits = n + cur->get_in_flight();
+      if (visits == 0) {
         return std::numeric_limits<double>::infinity(); 
       }
 
       double C = .5;
       double D = 1e5;
-      double q_bar = cur->get_q() / n;
+      double q_bar = n ? cur->get_q() / n : 0;
+      node_type* parent = cur->get_parent();
+      int parent_visits = parent->get_n() + parent->get_in_flight();
 
-      return q_bar + C * std::sqrt(std::log(cur->get_parent()->get_n()) / n) 
-        + std::sqrt((cur->get_ssq() - (n * q_bar * q_bar) + D)/n);
+      return q_bar + C * std::sqrt(std::log(parent_visits) / visits) 
+        + std::sqrt((cur->get_ssq() - (n * q_bar * q_bar) + D)/visits);
     }
 
     node_type* best_child(node_type* parent) {
@@ -203,8 +314,12 @@ class MCTS {
       double max_score = -std::numeric_limits<double>::infinity();
       std::vector<node_type*> best;
       for (auto& child : children) {
+        if (child.is_solved()) {
+          continue;
+        }
         double ucb1 = 0;
-        if (child.get_n() < 10) {
+        // the warm-up is for children nothing is on its way to yet
+        if (child.get_n() < 10 && !child.get_in_flight()) {
           ucb1 = std::numeric_limits<double>::infinity();
         } else {
           ucb1 = UCB1(&child);
@@ -217,37 +332,89 @@ class MCTS {
           best.push_back(&child);
         }
       }
-      return best[std::rand() % best.size()];
+      return best.empty() ? nullptr : best[rng_() % best.size()];
     }
 
+    // The child to play from parent, or null without children: the best
+    // proven child when its value is at least the best mean among the
+    // unsolved ones, which is always so once parent is solved, and the
+    // best by UCB otherwise.
+    node_type* next_move(node_type* parent) {
+      node_type* proven = nullptr;
+      double best_mean = -std::numeric_limits<double>::infinity();
+      for (auto& child : parent->get_children()) {
+        if (child.is_solved()) {
+          if (!proven || child.get_solved_value() > proven->get_solved_value()) {
+            proven = &child;
+          }
+        } else if (child.get_n() > 0) {
+          best_mean = std::max(best_mean, child.get_q() / child.get_n());
+        }
+      }
+      if (proven && proven->get_solved_value() >= best_mean) {
+        return proven;
+      }
+      node_type* next = best_child(parent);
+      return next ? next : proven;
+    }
+
+    // Solves cur if it can be, then its ancestors as far as they can be.
+    void solve_up(node_type* cur) {
+      while (cur && cur->try_solve()) {
+        cur = cur->get_parent();
+      }
+    }
+
+    // Descends by UCB past solved subtrees to a new node. Returns a solved
+    // node only when the search root is solved or every child of the node
+    // reached just got solved, which solves it in turn.
     node_type* tree_policy(node_type* cur) {
-      while (!cur->is_terminal()) {
+      while (!cur->is_solved()) {
         node_type* exp = cur->expand();
         if (exp) {
           num_nodes_++;
+          if (exp->is_solved()) {
+            solve_up(cur);
+          }
           return exp;
         }
-        if (cur->has_children()) {
-          cur = best_child(cur);
+        node_type* next = best_child(cur);
+        if (!next) {
+          solve_up(cur);
+          return cur;
         }
+        cur = next;
       }
       return cur;
     }
 
     double default_policy(node_type* cur) {
-      Env env(cur->get_env());
+      if (model_ && !cur->get_env().is_game_over()) {
+        const Env& env = cur->get_env();
+        return model_->rollout(env.get_num_steps(), env.get_total_reward(), rng_);
+      }
+      return play_out(cur);
+    }
 
-      typename Env::rollout_move_getter rmg = env.get_rmg();
+    // Plays env out with RolloutPolicy and returns its final reward.
+    static double play_out(Env& env, std::mt19937& rng) {
+      RolloutPolicy rmg(&env);
     
       while (!env.is_game_over()) {
-        std::vector<move_type> moves = rmg.get();
+        const std::vector<move_type>& moves = rmg.get();
         if (!moves.empty()) {
-          int rand_move_idx = std::rand() % moves.size();
+          int rand_move_idx = rng() % moves.size();
           move_type pos = moves[rand_move_idx];
           env.step(pos);
         }
       }
-      double reward = env.get_total_reward();
+      return env.get_total_reward();
+    }
+
+    // Plays the game out from cur with RolloutPolicy.
+    double play_out(node_type* cur) {
+      Env env(cur->get_env());
+      double reward = play_out(env, rng_);
       if (reward > high_score_) {
         high_score_ = reward;
         high_score_seq_ = env.get_seq(); 
@@ -255,6 +422,28 @@ class MCTS {
       return reward;
     }
 
+    template <class E = Env>
+    const auto& default_policy_batch(node_type* cur) {
+      static thread_local typename E::batch_type batch;
+      batch.load(cur->get_env());
+      const auto& rewards = batch.rollout(rng_, RolloutPolicy::tabu_color);
+
+      int best = std::max_element(rewards.begin(), rewards.end()) - rewards.begin();
+      if (rewards[best] > high_score_) {
+        high_score_ = rewards[best];
+        high_score_seq_ = cur->get_env().get_seq();
+        auto tail = batch.get_seq(best);
+        high_score_seq_.insert(high_score_seq_.end(), tail.begin(), tail.end());
+      }
+      return rewards;
+    }
+
+    // The best rollout's moves from where the search started, like seq_.
+    std::vector<move_type> high_score_moves() const {
+      std::size_t skip = std::min(start_steps_, high_score_seq_.size());
+      return std::vector<move_type>(high_score_seq_.begin() + skip, high_score_seq_.end());
+    }
+
     void backprop(node_type* cur, double q) {
       while (cur) {
         cur->set_q(cur->get_q() + q);
@@ -264,6 +453,68 @@ class MCTS {
       }
     }
 
+    // Backs up the proven value of a solved leaf instead of rolling it out
+    // and says whether it did. A leaf solved at -infinity has no game end
+    // left in the tree, so it is still rolled out.
+    bool backprop_solved(node_type* leaf) {
+      if (!leaf->is_solved() || leaf->get_solved_value() == -std::numeric_limits<double>::infinity()) {
+        return false;
+      }
+      double value = leaf->get_solved_value();
+      if (leaf->is_terminal() && value > high_score_) {
+        high_score_ = value;
+        high_score_seq_ = leaf->get_env().get_seq();
+      }
+      backprop(leaf, value);
+      num_iterations_++;
+      return true;
+    }
+
+    // whether the whole tree below the search root is proven
+    bool is_solved() const {
+      return cur_->is_solved();
+    }
+
+    // Does nothing once the search root is solved.
+    void iterate() {
+      if (cur_->is_solved()) {
+        return;
+      }
+      node_type* leaf = tree_policy(cur_);
+      if (backprop_solved(leaf)) {
+        return;
+      }
+      if constexpr (has_batch_rollout<Env>::value) {
+        if (leaf_parallel_) {
+          for (double reward : default_policy_batch(leaf)) {
+            backprop(leaf, reward);
+          }
+          num_iterations_++;
+          return;
+        }
+      }
+      double reward = default_policy(leaf);
+      backprop(leaf, reward);
+      num_iterations_++;
+    }
+
+    std::vector<move_type> best_sequence() {
+      while (node_type* next = next_move(cur_)) {
+        cur_ = next;
+        seq_.push_back(cur_->get_action());
+      }
+      // model rollouts leave no game behind, so finish this one for real
+      if (model_ && !cur_->is_terminal()) {
+        play_out(cur_);
+      }
+
+      if (cur_->is_terminal() && cur_->get_reward() > high_score_) {
+        return seq_;
+      } else {
+        return high_score_moves();
+      }
+    }
+
     std::vector<move_type> search(int iterations) {
       while (!cur_->is_terminal()) {
         cur_->get_env().render();
@@ -271,24 +522,23 @@ class MCTS {
           if (i > 0 && i % 1000 == 0) {
               std::cout << "i: " << i << " num_nodes: " << num_nodes_ << std::endl;
           }
-          node_type* leaf = tree_policy(cur_);
-          double reward = default_policy(leaf);
-          backprop(leaf, reward);
+          iterate();
         }
 
-        std::size_t num_nodes_created = num_nodes_;
-        if (cur_->has_children()) {
-          cur_ = best_child(cur_);
-          seq_.push_back(cur_->get_action());
-          std::cout << "move made: (" << cur_->get_action().first 
-            << ", " << cur_->get_action().second << ")" << std::endl;
+        node_type* next = next_move(cur_);
+        if (!next) {
+          break;
         }
+        cur_ = next;
+        seq_.push_back(cur_->get_action());
+        std::cout << "move made: (" << cur_->get_action().first 
+          << ", " << cur_->get_action().second << ")" << std::endl;
       }
       cur_->get_env().render();
       if (cur_->is_terminal() && cur_->get_reward() > high_score_) {
         return seq_;
       } else {
-        return high_score_seq_;
+        return high_score_moves();
       }
     }
 
@@ -301,17 +551,16 @@ class MCTS {
           if (i > 0 && i % 1000 == 0) {
               std::cout << "i: " << i << " num_nodes: " << num_nodes_ << std::endl;
           }
-          node_type* leaf = tree_policy(cur_);
-          double reward = default_policy(leaf);
-          backprop(leaf, reward);
+          iterate();
         }
 
-        std::size_t num_nodes_created = num_nodes_;
-        if (cur_->has_children()) {
-          make_move(best_child(cur_));
-          std::cout << "move made: (" << cur_->get_action().first 
-            << ", " << cur_->get_action().second << ")" << std::endl;
+        node_type* next = next_move(cur_);
+        if (!next) {
+          break;
         }
+        make_move(next);
+        std::cout << "move made: (" << cur_->get_action().first 
+          << ", " << cur_->get_action().second << ")" << std::endl;
       }
       return cur_->get_reward();
     }
@@ -319,24 +568,160 @@ class MCTS {
     std::vector<move_type> search_aio(int iterations) {
       cur_->get_env().render();
 
-      for (std::size_t i = 0; i < iterations; i++) {
+      for (std::size_t i = 0; i < iterations && !cur_->is_solved(); i++) {
         if (i > 0 && i % 1000 == 0) {
             std::cout << "i: " << i << " num_nodes: " << num_nodes_ << std::endl;
           }
-          node_type* leaf = tree_policy(cur_);
-          double reward = default_policy(leaf);
-          backprop(leaf, reward);
+          iterate();
       }
 
-      while (cur_->has_children()) {
-        cur_ = best_child(cur_);
-        seq_.push_back(cur_->get_action());
+      return best_sequence();
+    }
+
+    // Same as search_aio, but runs until the wall-clock budget is spent
+    // and prints nothing, so several searches can share a terminal.
+    std::vector<move_type> search_for(double seconds) {
+      using clock = std::chrono::steady_clock;
+      auto deadline = clock::now() + std::chrono::duration<double>(seconds);
+      do {
+        for (int i = 0; i < 16; i++) {
+          iterate();
+        }
+      } while (clock::now() < deadline && !cur_->is_solved());
+
+      return best_sequence();
+    }
+
+    // Same as search_for, but as a pipeline: this thread selects leaves and
+    // backpropagates while num_workers threads play them out. Leaves go to
+    // the workers through one lock-free ring and rewards come back through
+    // another, with at most max_in_flight rollouts outstanding (twice the
+    // workers by default), so selection and rollouts overlap. Only this
+    // thread touches the tree. Leaf parallelism does not apply here.
+    std::vector<move_type> search_pipelined(double seconds, unsigned num_workers,
+        std::size_t max_in_flight = 0) {
+      using clock = std::chrono::steady_clock;
+      auto deadline = clock::now() + std::chrono::duration<double>(seconds);
+      num_workers = std::max(1u, num_workers);
+      if (!max_in_flight) {
+        max_in_flight = 2 * num_workers;
       }
 
-      if (cur_->is_terminal() && cur_->get_reward() > high_score_) {
-        return seq_;
-      } else {
-        return high_score_seq_;
+      struct job {
+        std::size_t slot;
+        Env env;
+      };
+      struct result {
+        std::size_t slot;
+        double reward;
+      };
+      mpmc_ring<job> jobs(max_in_flight);
+      mpmc_ring<result> results(max_in_flight);
+      std::atomic<bool> done(false);
+
+      // each worker keeps its own best game, merged in once they stop
+      struct best_game {
+        double reward = -std::numeric_limits<double>::infinity();
+        std::vector<move_type> seq;
+      };
+      std::vector<best_game> best(num_workers);
+      std::vector<std::thread> workers;
+      for (unsigned w = 0; w < num_workers; w++) {
+        workers.emplace_back([&, w, seed = rng_()]() {
+          std::mt19937 rng(seed);
+          while (true) {
+            std::optional<job> j = jobs.try_pop();
+            if (!j) {
+              if (done.load(std::memory_order_acquire)) {
+                return;
+              }
+              std::this_thread::yield();
+              continue;
+            }
+            double reward;
+            if (model_ && !j->env.is_game_over()) {
+              reward = model_->rollout(j->env.get_num_steps(), j->env.get_total_reward(), rng);
+            } else {
+              reward = play_out(j->env, rng);
+              if (reward > best[w].reward) {
+                best[w].reward = reward;
+                best[w].seq = j->env.get_seq();
+              }
+            }
+            while (!results.try_push(result{j->slot, reward})) {
+              std::this_thread::yield();
+            }
+          }
+        });
+      }
+
+      // A leaf is remembered by its child indices from cur_ rather than by
+      // address: its parent may still be expanding, and growing the
+      // children vector moves it. Nodes with children never move, since a
+      // node is only descended through once all its moves are expanded.
+      std::vector<std::vector<std::size_t>> paths(max_in_flight);
+      std::vector<std::size_t> free_slots;
+      for (std::size_t i = max_in_flight; i-- > 0;) {
+        free_slots.push_back(i);
+      }
+      std::size_t in_flight = 0;
+
+      auto finish = [&](const result& res) {
+        node_type* cur = cur_;
+        cur->set_in_flight(cur->get_in_flight() - 1);
+        for (std::size_t i : paths[res.slot]) {
+          cur = &cur->get_children()[i];
+          cur->set_in_flight(cur->get_in_flight() - 1);
+        }
+        backprop(cur, res.reward);
+        num_iterations_++;
+        free_slots.push_back(res.slot);
+        in_flight--;
+      };
+
+      while (true) {
+        while (std::optional<result> res = results.try_pop()) {
+          finish(*res);
+        }
+        bool searching = !cur_->is_solved() && clock::now() < deadline;
+        if (!searching && !in_flight) {
+          break;
+        }
+        if (!searching || in_flight == max_in_flight) {
+          std::this_thread::yield();
+          continue;
+        }
+
+        node_type* leaf = tree_policy(cur_);
+        if (backprop_solved(leaf)) {
+          continue;
+        }
+
+        std::size_t slot = free_slots.back();
+        free_slots.pop_back();
+        std::vector<std::size_t>& path = paths[slot];
+        path.clear();
+        for (node_type* cur = leaf; cur != cur_; cur = cur->get_parent()) {
+          cur->set_in_flight(cur->get_in_flight() + 1);
+          path.push_back(cur - &cur->get_parent()->get_children()[0]);
+        }
+        cur_->set_in_flight(cur_->get_in_flight() + 1);
+        std::reverse(path.begin(), path.end());
+        in_flight++;
+        // cannot fail: the ring holds max_in_flight jobs
+        jobs.try_push(job{slot, leaf->get_env()});
+      }
+
+      done.store(true, std::memory_order_release);
+      for (auto& worker : workers) {
+        worker.join();
+      }
+      for (auto& game : best) {
+        if (game.reward > high_score_) {
+          high_score_ = game.reward;
+          high_score_seq_ = std::move(game.seq);
+        }
       }
+      return best_sequence();
     }
 };
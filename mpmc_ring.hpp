@@ -0,0 +1,89 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <utility>
+
+// Bounded lock-free queue for any number of producers and consumers
+// (Vyukov's). Every cell carries a sequence number telling whether it is
+// free or full in the current lap around the ring, so a push or pop is one
+// compare-and-swap on its own index and never waits on the other side.
+// try_push fails when the ring is full and try_pop comes back empty when
+// the ring is.
+template <class T>
+class mpmc_ring {
+  private:
+    struct cell {
+      std::atomic<std::size_t> sequence;
+      std::optional<T> value;
+    };
+
+    std::unique_ptr<cell[]> cells_;
+    std::size_t mask_;
+    // next cell to pop and to push, on separate cache lines
+    alignas(64) std::atomic<std::size_t> head_{0};
+    alignas(64) std::atomic<std::size_t> tail_{0};
+  public:
+    // capacity is rounded up to a power of two
+    explicit mpmc_ring(std::size_t capacity) {
+      std::size_t size = 2;
+      while (size < capacity) {
+        size *= 2;
+      }
+      cells_.reset(new cell[size]);
+      for (std::size_t i = 0; i < size; i++) {
+        cells_[i].sequence.store(i, std::memory_order_relaxed);
+      }
+      mask_ = size - 1;
+    }
+
+    mpmc_ring(const mpmc_ring&) = delete;
+    mpmc_ring& operator=(const mpmc_ring&) = delete;
+
+    std::size_t capacity() const {
+      return mask_ + 1;
+    }
+
+    bool try_push(T&& value) {
+      std::size_t pos = tail_.load(std::memory_order_relaxed);
+      while (true) {
+        cell& c = cells_[pos & mask_];
+        std::size_t seq = c.sequence.load(std::memory_order_acquire);
+        std::intptr_t diff = std::intptr_t(seq) - std::intptr_t(pos);
+        if (diff == 0) {
+          if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+            c.value.emplace(std::move(value));
+            c.sequence.store(pos + 1, std::memory_order_release);
+            return true;
+          }
+        } else if (diff < 0) {
+          return false;
+        } else {
+          pos = tail_.load(std::memory_order_relaxed);
+        }
+      }
+    }
+
+    std::optional<T> try_pop() {
+      std::size_t pos = head_.load(std::memory_order_relaxed);
+      while (true) {
+        cell& c = cells_[pos & mask_];
+        std::size_t seq = c.sequence.load(std::memory_order_acquire);
+        std::intptr_t diff = std::intptr_t(seq) - std::intptr_t(pos + 1);
+        if (diff == 0) {
+          if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+            std::optional<T> value(std::move(c.value));
+            c.value.reset();
+            c.sequence.store(pos + mask_ + 1, std::memory_order_release);
+            return value;
+          }
+        } else if (diff < 0) {
+          return std::nullopt;
+        } else {
+          pos = head_.load(std::memory_order_relaxed);
+        }
+      }
+    }
+};
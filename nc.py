@@ -9,10 +9,26 @@ alpha ~ N(0, 10)
 beta ~ N(0, 50)
 '''
 
-with open('nc', 'r') as nc_f:
-    lines = [line[:-1] for line in nc_f.readlines()]
-    Y = np.array([int(line.split(',')[0]) for line in lines])
-    X = np.array([int(line.split(',')[1]) for line in lines])
+# one (arity, depth) observation per expanded node, expanded from the
+# per-depth arity histograms in the summary search() writes
+arities = list()
+depths = list()
+counts = list()
+with open('tree_stats', 'r') as ts_f:
+    for line in ts_f:
+        fields = line.split()
+        if fields[0] == 'arity':
+            for pair in fields[2:]:
+                arity, count = pair.split(':')
+                # terminals belong to td.py; older summaries listed them here
+                if arity == '0':
+                    continue
+                arities.append(int(arity))
+                depths.append(int(fields[1]))
+                counts.append(int(count))
+
+Y = np.repeat(np.array(arities), counts)
+X = np.repeat(np.array(depths), counts)
 
 basic_model = pm.Model()
 
@@ -0,0 +1,853 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <limits>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <variant>
+#include <vector>
+#include "mcts.hpp"
+#include "same_game_env.hpp"
+#include "sokoban_env.hpp"
+
+// CPython bindings for the C++ envs and MCTS, so the Python experiment
+// scripts run at C++ speed:
+//
+//   import pfmcts
+//   env = pfmcts.same_game(seed=32)      # or board=bytes(225), x * 15 + y
+//   env = pfmcts.sokoban("skbn_cfgs/level", push=True)
+//   m = pfmcts.MCTS(env, seed=1)
+//   seq = m.search(iterations=10000)     # or seconds=1.0
+//   stats = m.tree_stats()
+//   rewards = pfmcts.rollouts(env, 1000, seed=0, threads=4)
+//
+// Searches and rollouts run without the GIL. Move sequences, rewards and
+// tree statistics come back as read-only pfmcts.Array objects, which hand
+// the C++ vector they were built in to the buffer protocol, so
+// numpy.asarray or memoryview use it without a copy. Same game moves are
+// (x, y) rows of int16, Sokoban steps are directions and pushes are
+// (cell, direction) rows. step() takes a move as any sequence of ints, so
+// a row of an Array, a tuple or a list all work.
+//
+//   make pfmcts && python3 pfmcts_smoke.py
+
+namespace {
+
+using same_game_type = standard_same_game_env;
+using env_variant = std::variant<same_game_type, sokoban_env, sokoban_push_env>;
+
+template <class T>
+constexpr char format_of() {
+  static_assert(std::is_arithmetic<T>::value, "arrays hold numbers");
+  if (std::is_floating_point<T>::value) {
+    return sizeof(T) == 4 ? 'f' : 'd';
+  }
+  switch (sizeof(T)) {
+    case 1: return std::is_signed<T>::value ? 'b' : 'B';
+    case 2: return std::is_signed<T>::value ? 'h' : 'H';
+    case 4: return std::is_signed<T>::value ? 'i' : 'I';
+    default: return std::is_signed<T>::value ? 'q' : 'Q';
+  }
+}
+
+// pfmcts.Array: a read-only array of up to two dimensions that owns the
+// vector behind it.
+struct array_object {
+  PyObject_HEAD
+  std::shared_ptr<void> owner;
+  void* data;
+  char format[2];
+  Py_ssize_t itemsize;
+  int ndim;
+  Py_ssize_t shape[2];
+  Py_ssize_t strides[2];
+};
+
+// Types Python code must not make itself: Array and Env come only from the
+// module. The flag is new in 3.10; add_type clears tp_new before that.
+#if PY_VERSION_HEX >= 0x030A0000
+constexpr unsigned long no_instantiation = Py_TPFLAGS_DISALLOW_INSTANTIATION;
+#else
+constexpr unsigned long no_instantiation = 0;
+#endif
+
+PyTypeObject* array_type = nullptr;
+PyTypeObject* env_type = nullptr;
+PyTypeObject* mcts_type = nullptr;
+
+// Moves v into a new array of rows of cols values of type Scalar, which
+// the elements of v are made of.
+template <class Scalar, class T>
+PyObject* make_array(std::vector<T>&& v, Py_ssize_t cols = 0) {
+  static_assert(sizeof(T) % sizeof(Scalar) == 0, "elements are whole scalars");
+  auto* self = PyObject_New(array_object, array_type);
+  if (!self) {
+    return nullptr;
+  }
+  auto owner = std::make_shared<std::vector<T>>(std::move(v));
+  static Scalar empty{};
+  new (&self->owner) std::shared_ptr<void>(owner);
+  self->data = owner->empty() ? static_cast<void*>(&empty) : static_cast<void*>(owner->data());
+  self->format[0] = format_of<Scalar>();
+  self->format[1] = 0;
+  self->itemsize = sizeof(Scalar);
+  Py_ssize_t size = owner->size() * (sizeof(T) / sizeof(Scalar));
+  if (cols > 0) {
+    self->ndim = 2;
+    self->shape[0] = size / cols;
+    self->shape[1] = cols;
+    self->strides[0] = cols * sizeof(Scalar);
+    self->strides[1] = sizeof(Scalar);
+  } else {
+    self->ndim = 1;
+    self->shape[0] = size;
+    self->strides[0] = sizeof(Scalar);
+  }
+  return reinterpret_cast<PyObject*>(self);
+}
+
+void array_dealloc(PyObject* obj) {
+  auto* self = reinterpret_cast<array_object*>(obj);
+  self->owner.~shared_ptr<void>();
+  PyTypeObject* type = Py_TYPE(obj);
+  type->tp_free(obj);
+  Py_DECREF(type);
+}
+
+int array_getbuffer(PyObject* obj, Py_buffer* view, int flags) {
+  auto* self = reinterpret_cast<array_object*>(obj);
+  if (flags & PyBUF_WRITABLE) {
+    PyErr_SetString(PyExc_BufferError, "pfmcts.Array is read-only");
+    return -1;
+  }
+  view->obj = obj;
+  Py_INCREF(obj);
+  view->buf = self->data;
+  view->itemsize = self->itemsize;
+  view->len = self->itemsize;
+  for (int i = 0; i < self->ndim; i++) {
+    view->len *= self->shape[i];
+  }
+  view->readonly = 1;
+  view->format = (flags & PyBUF_FORMAT) ? self->format : nullptr;
+  view->ndim = (flags & PyBUF_ND) ? self->ndim : 1;
+  view->shape = (flags & PyBUF_ND) ? self->shape : nullptr;
+  view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? self->strides : nullptr;
+  view->suboffsets = nullptr;
+  view->internal = nullptr;
+  return 0;
+}
+
+Py_ssize_t array_length(PyObject* obj) {
+  return reinterpret_cast<array_object*>(obj)->shape[0];
+}
+
+template <class T>
+PyObject* load_to_py(const char* p) {
+  T value;
+  std::memcpy(&value, p, sizeof(T));
+  if constexpr (std::is_floating_point<T>::value) {
+    return PyFloat_FromDouble(value);
+  } else if constexpr (std::is_signed<T>::value) {
+    return PyLong_FromLongLong(value);
+  } else {
+    return PyLong_FromUnsignedLongLong(value);
+  }
+}
+
+// The number at p, of the type format_of names.
+PyObject* scalar_to_py(char format, const char* p) {
+  switch (format) {
+    case 'f': return load_to_py<float>(p);
+    case 'd': return load_to_py<double>(p);
+    case 'b': return load_to_py<std::int8_t>(p);
+    case 'B': return load_to_py<std::uint8_t>(p);
+    case 'h': return load_to_py<std::int16_t>(p);
+    case 'H': return load_to_py<std::uint16_t>(p);
+    case 'i': return load_to_py<std::int32_t>(p);
+    case 'I': return load_to_py<std::uint32_t>(p);
+    case 'q': return load_to_py<std::int64_t>(p);
+    default: return load_to_py<std::uint64_t>(p);
+  }
+}
+
+// A number of a one-dimensional array, or a row of a table as a
+// one-dimensional array sharing its vector.
+PyObject* array_item(PyObject* obj, Py_ssize_t i) {
+  auto* self = reinterpret_cast<array_object*>(obj);
+  if (i < 0 || i >= self->shape[0]) {
+    PyErr_SetString(PyExc_IndexError, "pfmcts.Array index out of range");
+    return nullptr;
+  }
+  char* item = static_cast<char*>(self->data) + i * self->strides[0];
+  if (self->ndim == 1) {
+    return scalar_to_py(self->format[0], item);
+  }
+  auto* row = PyObject_New(array_object, array_type);
+  if (!row) {
+    return nullptr;
+  }
+  new (&row->owner) std::shared_ptr<void>(self->owner);
+  row->data = item;
+  std::memcpy(row->format, self->format, sizeof(row->format));
+  row->itemsize = self->itemsize;
+  row->ndim = 1;
+  row->shape[0] = self->shape[1];
+  row->strides[0] = self->strides[1];
+  return reinterpret_cast<PyObject*>(row);
+}
+
+PyObject* array_tolist(PyObject* obj, PyObject*) {
+  PyObject* view = PyMemoryView_FromObject(obj);
+  if (!view) {
+    return nullptr;
+  }
+  PyObject* list = PyObject_CallMethod(view, "tolist", nullptr);
+  Py_DECREF(view);
+  return list;
+}
+
+PyObject* array_get_shape(PyObject* obj, void*) {
+  auto* self = reinterpret_cast<array_object*>(obj);
+  return self->ndim == 2 ? Py_BuildValue("(nn)", self->shape[0], self->shape[1]) :
+    Py_BuildValue("(n)", self->shape[0]);
+}
+
+PyMethodDef array_methods[] = {
+  {"tolist", array_tolist, METH_NOARGS, "The values as (nested) lists."},
+  {nullptr, nullptr, 0, nullptr},
+};
+
+PyGetSetDef array_getset[] = {
+  {"shape", array_get_shape, nullptr, "Rows, and columns for a table.", nullptr},
+  {nullptr, nullptr, nullptr, nullptr, nullptr},
+};
+
+PyType_Slot array_slots[] = {
+  {Py_tp_dealloc, reinterpret_cast<void*>(array_dealloc)},
+  {Py_tp_methods, array_methods},
+  {Py_tp_getset, array_getset},
+  {Py_bf_getbuffer, reinterpret_cast<void*>(array_getbuffer)},
+  {Py_sq_length, reinterpret_cast<void*>(array_length)},
+  {Py_sq_item, reinterpret_cast<void*>(array_item)},
+  {Py_tp_doc, const_cast<char*>("Read-only numbers shared with C++ through the buffer protocol.")},
+  {0, nullptr},
+};
+
+PyType_Spec array_spec = {
+  "pfmcts.Array", sizeof(array_object), 0, Py_TPFLAGS_DEFAULT | no_instantiation, array_slots,
+};
+
+// Moves to and from Python, per env.
+
+PyObject* moves_to_array(std::vector<same_game_type::move_type>&& moves) {
+  static_assert(sizeof(same_game_type::move_type) == 2 * sizeof(short), "moves are two shorts");
+  return make_array<short>(std::move(moves), 2);
+}
+
+PyObject* moves_to_array(std::vector<sokoban_env::move_type>&& moves) {
+  std::vector<std::int8_t> flat(moves.begin(), moves.end());
+  return make_array<std::int8_t>(std::move(flat));
+}
+
+PyObject* moves_to_array(std::vector<sokoban_push_env::move_type>&& moves) {
+  std::vector<std::int32_t> flat;
+  flat.reserve(2 * moves.size());
+  for (auto& move : moves) {
+    flat.push_back(move.first);
+    flat.push_back(move.second);
+  }
+  return make_array<std::int32_t>(std::move(flat), 2);
+}
+
+// Reads a move of two ints from any sequence: a tuple, a list or a row of
+// an Array. TypeError if it is not a sequence of ints, ValueError if it
+// has not two of them or one is out of [min, max].
+bool pair_from_py(PyObject* obj, long& first, long& second, long min, long max) {
+  if (PyUnicode_Check(obj) || PyBytes_Check(obj) || !PySequence_Check(obj)) {
+    PyErr_Format(PyExc_TypeError, "a move is a pair of ints, not %s", Py_TYPE(obj)->tp_name);
+    return false;
+  }
+  PyObject* seq = PySequence_Fast(obj, "a move is a pair of ints");
+  if (!seq) {
+    return false;
+  }
+  bool ok = PySequence_Fast_GET_SIZE(seq) == 2;
+  if (!ok) {
+    PyErr_SetString(PyExc_ValueError, "a move is a pair of ints");
+  }
+  long* out[] = {&first, &second};
+  for (int i = 0; ok && i < 2; i++) {
+    PyObject* index = PyNumber_Index(PySequence_Fast_GET_ITEM(seq, i));
+    ok = index != nullptr;
+    if (ok) {
+      *out[i] = PyLong_AsLong(index);
+      Py_DECREF(index);
+      ok = !(*out[i] == -1 && PyErr_Occurred());
+    }
+  }
+  Py_DECREF(seq);
+  if (ok && (first < min || first > max || second < min || second > max)) {
+    PyErr_Format(PyExc_ValueError, "move (%ld, %ld) out of range", first, second);
+    ok = false;
+  }
+  if (!ok && PyErr_ExceptionMatches(PyExc_OverflowError)) {
+    PyErr_SetString(PyExc_ValueError, "move out of range");
+  }
+  return ok;
+}
+
+bool move_from_py(PyObject* obj, same_game_type::move_type& move) {
+  long x, y;
+  if (!pair_from_py(obj, x, y, std::numeric_limits<short>::min(), std::numeric_limits<short>::max())) {
+    return false;
+  }
+  move = same_game_type::move_type(x, y);
+  return true;
+}
+
+bool move_from_py(PyObject* obj, sokoban_env::move_type& move) {
+  long dir = PyLong_AsLong(obj);
+  if (dir == -1 && PyErr_Occurred()) {
+    return false;
+  }
+  if (dir < sokoban_env::up || dir > sokoban_env::LEFT) {
+    PyErr_SetString(PyExc_ValueError, "not a direction");
+    return false;
+  }
+  move = sokoban_env::direction(dir);
+  return true;
+}
+
+bool move_from_py(PyObject* obj, sokoban_push_env::move_type& move) {
+  long cell, dir;
+  if (!pair_from_py(obj, cell, dir, std::numeric_limits<int>::min(), std::numeric_limits<int>::max())) {
+    return false;
+  }
+  if (dir < sokoban_push_env::UP || dir > sokoban_push_env::LEFT) {
+    PyErr_SetString(PyExc_ValueError, "not a push direction");
+    return false;
+  }
+  move.first = cell;
+  move.second = sokoban_push_env::direction(dir);
+  return true;
+}
+
+// Runs f without the GIL, turning a C++ exception into a Python one.
+template <class F>
+bool without_gil(F f) {
+  std::exception_ptr error;
+  Py_BEGIN_ALLOW_THREADS
+  try {
+    f();
+  } catch (...) {
+    error = std::current_exception();
+  }
+  Py_END_ALLOW_THREADS
+  if (error) {
+    try {
+      std::rethrow_exception(error);
+    } catch (const std::exception& e) {
+      PyErr_SetString(PyExc_RuntimeError, e.what());
+    } catch (...) {
+      PyErr_SetString(PyExc_RuntimeError, "unknown C++ exception");
+    }
+    return false;
+  }
+  return true;
+}
+
+// pfmcts.Env: one state of any of the games.
+
+struct env_object {
+  PyObject_HEAD
+  env_variant env;
+};
+
+PyObject* wrap_env(env_variant&& env) {
+  auto* self = PyObject_New(env_object, env_type);
+  if (!self) {
+    return nullptr;
+  }
+  new (&self->env) env_variant(std::move(env));
+  return reinterpret_cast<PyObject*>(self);
+}
+
+env_variant& env_of(PyObject* obj) {
+  return reinterpret_cast<env_object*>(obj)->env;
+}
+
+void env_dealloc(PyObject* obj) {
+  env_of(obj).~env_variant();
+  PyTypeObject* type = Py_TYPE(obj);
+  type->tp_free(obj);
+  Py_DECREF(type);
+}
+
+PyObject* env_moves(PyObject* obj, PyObject*) {
+  return std::visit([](auto& env) { return moves_to_array(env.get_possible_moves()); }, env_of(obj));
+}
+
+PyObject* env_seq(PyObject* obj, PyObject*) {
+  return std::visit([](auto& env) { return moves_to_array(env.get_seq()); }, env_of(obj));
+}
+
+// The envs assume their moves are legal, so anything else from Python is
+// turned away here rather than corrupting the board or aborting.
+PyObject* env_step(PyObject* obj, PyObject* arg) {
+  bool ok = std::visit([&](auto& env) {
+    typename std::decay_t<decltype(env)>::move_type move;
+    if (!move_from_py(arg, move)) {
+      return false;
+    }
+    auto moves = env.get_possible_moves();
+    if (std::find(moves.begin(), moves.end(), move) == moves.end()) {
+      PyErr_SetString(PyExc_ValueError, "illegal move");
+      return false;
+    }
+    env.step(move);
+    return true;
+  }, env_of(obj));
+  if (!ok) {
+    return nullptr;
+  }
+  Py_RETURN_NONE;
+}
+
+PyObject* env_copy(PyObject* obj, PyObject*) {
+  return wrap_env(env_variant(env_of(obj)));
+}
+
+PyObject* env_render(PyObject* obj, PyObject*) {
+  std::visit([](auto& env) { env.render(); }, env_of(obj));
+  std::cout.flush();
+  Py_RETURN_NONE;
+}
+
+PyObject* env_is_game_over(PyObject* obj, PyObject*) {
+  return PyBool_FromLong(std::visit([](auto& env) { return env.is_game_over(); }, env_of(obj)));
+}
+
+PyObject* env_get_total_reward(PyObject* obj, void*) {
+  return PyFloat_FromDouble(std::visit([](auto& env) { return double(env.get_total_reward()); }, env_of(obj)));
+}
+
+PyObject* env_get_num_steps(PyObject* obj, void*) {
+  return PyLong_FromLong(std::visit([](auto& env) { return env.get_num_steps(); }, env_of(obj)));
+}
+
+PyObject* env_get_hash(PyObject* obj, void*) {
+  return PyLong_FromSize_t(std::visit([](auto& env) { return env.hash(); }, env_of(obj)));
+}
+
+PyMethodDef env_methods[] = {
+  {"moves", env_moves, METH_NOARGS, "The legal moves as an Array."},
+  {"seq", env_seq, METH_NOARGS, "The moves played so far as an Array."},
+  {"step", env_step, METH_O,
+    "Plays a move: (x, y), a direction or (cell, direction). ValueError if it is not legal."},
+  {"copy", env_copy, METH_NOARGS, "An independent copy of the state."},
+  {"render", env_render, METH_NOARGS, "Prints the state."},
+  {"is_game_over", env_is_game_over, METH_NOARGS, "Whether the game has ended."},
+  {nullptr, nullptr, 0, nullptr},
+};
+
+PyGetSetDef env_getset[] = {
+  {"total_reward", env_get_total_reward, nullptr, "Reward so far.", nullptr},
+  {"num_steps", env_get_num_steps, nullptr, "Moves played so far.", nullptr},
+  {"hash", env_get_hash, nullptr, "Hash of the state.", nullptr},
+  {nullptr, nullptr, nullptr, nullptr, nullptr},
+};
+
+PyType_Slot env_slots[] = {
+  {Py_tp_dealloc, reinterpret_cast<void*>(env_dealloc)},
+  {Py_tp_methods, env_methods},
+  {Py_tp_getset, env_getset},
+  {Py_tp_doc, const_cast<char*>("A game state; make one with pfmcts.same_game or pfmcts.sokoban.")},
+  {0, nullptr},
+};
+
+PyType_Spec env_spec = {
+  "pfmcts.Env", sizeof(env_object), 0, Py_TPFLAGS_DEFAULT | no_instantiation, env_slots,
+};
+
+// pfmcts.MCTS: one search from one env.
+
+using mcts_variant = std::variant<std::unique_ptr<MCTS<same_game_type>>,
+  std::unique_ptr<MCTS<sokoban_env>>, std::unique_ptr<MCTS<sokoban_push_env>>>;
+
+struct mcts_object {
+  PyObject_HEAD
+  mcts_variant mcts;
+  // set while a search runs without the GIL, so no other thread touches it
+  bool busy;
+  bool searched;
+};
+
+mcts_object* as_mcts(PyObject* obj) {
+  return reinterpret_cast<mcts_object*>(obj);
+}
+
+PyObject* mcts_new(PyTypeObject* type, PyObject* args, PyObject* kwargs) {
+  static const char* keywords[] = {"env", "seed", nullptr};
+  PyObject* env;
+  PyObject* seed_obj = Py_None;
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!|O", const_cast<char**>(keywords),
+        env_type, &env, &seed_obj)) {
+    return nullptr;
+  }
+  unsigned seed = std::random_device{}();
+  if (seed_obj != Py_None) {
+    seed = PyLong_AsUnsignedLongMask(seed_obj);
+    if (PyErr_Occurred()) {
+      return nullptr;
+    }
+  }
+  auto* self = reinterpret_cast<mcts_object*>(type->tp_alloc(type, 0));
+  if (!self) {
+    return nullptr;
+  }
+  new (&self->mcts) mcts_variant(std::visit([&](auto& e) {
+    using E = std::decay_t<decltype(e)>;
+    return mcts_variant(std::make_unique<MCTS<E>>(e, seed));
+  }, env_of(env)));
+  self->busy = false;
+  self->searched = false;
+  return reinterpret_cast<PyObject*>(self);
+}
+
+void mcts_dealloc(PyObject* obj) {
+  as_mcts(obj)->mcts.~mcts_variant();
+  PyTypeObject* type = Py_TYPE(obj);
+  type->tp_free(obj);
+  Py_DECREF(type);
+}
+
+bool check_idle(mcts_object* self) {
+  if (self->busy) {
+    PyErr_SetString(PyExc_RuntimeError, "the search is running in another thread");
+    return false;
+  }
+  return true;
+}
+
+PyObject* mcts_search(PyObject* obj, PyObject* args, PyObject* kwargs) {
+  static const char* keywords[] = {"iterations", "seconds", nullptr};
+  Py_ssize_t iterations = 0;
+  double seconds = 0;
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|nd", const_cast<char**>(keywords),
+        &iterations, &seconds)) {
+    return nullptr;
+  }
+  mcts_object* self = as_mcts(obj);
+  if (!check_idle(self)) {
+    return nullptr;
+  }
+  if (self->searched) {
+    PyErr_SetString(PyExc_RuntimeError, "an MCTS searches once; make a new one");
+    return nullptr;
+  }
+  if ((iterations > 0) == (seconds > 0)) {
+    PyErr_SetString(PyExc_ValueError, "give either iterations or seconds");
+    return nullptr;
+  }
+  self->busy = true;
+  self->searched = true;
+  PyObject* result = nullptr;
+  std::visit([&](auto& mcts) {
+    decltype(mcts->best_sequence()) seq;
+    bool ok = without_gil([&]() {
+      if (seconds > 0) {
+        seq = mcts->search_for(seconds);
+      } else {
+        for (Py_ssize_t i = 0; i < iterations && !mcts->is_solved(); i++) {
+          mcts->iterate();
+        }
+        seq = mcts->best_sequence();
+      }
+    });
+    if (ok) {
+      result = moves_to_array(std::move(seq));
+    }
+  }, self->mcts);
+  self->busy = false;
+  return result;
+}
+
+// Per depth below the search root: the arity histogram of the tree's
+// nodes, and their summed visits and returns.
+PyObject* mcts_tree_stats(PyObject* obj, PyObject*) {
+  mcts_object* self = as_mcts(obj);
+  if (!check_idle(self)) {
+    return nullptr;
+  }
+  std::vector<std::vector<std::uint64_t>> arity;
+  std::vector<std::uint64_t> visits;
+  std::vector<double> value;
+  std::size_t max_arity = 0;
+  std::visit([&](auto& mcts) {
+    using node_type = typename std::decay_t<decltype(*mcts)>::node_type;
+    std::vector<std::pair<node_type*, std::size_t>> stack{{&mcts->get_root(), 0}};
+    while (!stack.empty()) {
+      auto [cur, depth] = stack.back();
+      stack.pop_back();
+      if (arity.size() <= depth) {
+        arity.resize(depth + 1);
+        visits.resize(depth + 1);
+        value.resize(depth + 1);
+      }
+      auto& children = cur->get_children();
+      if (arity[depth].size() <= children.size()) {
+        arity[depth].resize(children.size() + 1);
+      }
+      arity[depth][children.size()]++;
+      max_arity = std::max(max_arity, children.size());
+      visits[depth] += cur->get_n();
+      value[depth] += cur->get_q();
+      for (auto& child : children) {
+        stack.emplace_back(&child, depth + 1);
+      }
+    }
+  }, self->mcts);
+
+  std::vector<std::uint64_t> table(arity.size() * (max_arity + 1));
+  for (std::size_t d = 0; d < arity.size(); d++) {
+    std::copy(arity[d].begin(), arity[d].end(), table.begin() + d * (max_arity + 1));
+  }
+  PyObject* arity_obj = make_array<std::uint64_t>(std::move(table), max_arity + 1);
+  PyObject* visits_obj = make_array<std::uint64_t>(std::move(visits));
+  PyObject* value_obj = make_array<double>(std::move(value));
+  PyObject* result = nullptr;
+  if (arity_obj && visits_obj && value_obj) {
+    result = Py_BuildValue("{sOsOsO}", "arity", arity_obj, "visits", visits_obj, "value", value_obj);
+  }
+  Py_XDECREF(arity_obj);
+  Py_XDECREF(visits_obj);
+  Py_XDECREF(value_obj);
+  return result;
+}
+
+PyObject* mcts_get_num_iterations(PyObject* obj, void*) {
+  return PyLong_FromSize_t(std::visit([](auto& m) { return m->get_num_iterations(); }, as_mcts(obj)->mcts));
+}
+
+PyObject* mcts_get_num_nodes(PyObject* obj, void*) {
+  return PyLong_FromSize_t(std::visit([](auto& m) { return m->get_num_nodes(); }, as_mcts(obj)->mcts));
+}
+
+PyMethodDef mcts_methods[] = {
+  {"search", reinterpret_cast<PyCFunction>(reinterpret_cast<void(*)()>(mcts_search)),
+    METH_VARARGS | METH_KEYWORDS,
+    "search(iterations=0, seconds=0.0): searches for a number of iterations or a time "
+    "and returns the best move sequence as an Array."},
+  {"tree_stats", mcts_tree_stats, METH_NOARGS,
+    "Per depth: 'arity', a depth x arity table of node counts, and the summed 'visits' "
+    "and 'value' of the nodes."},
+  {nullptr, nullptr, 0, nullptr},
+};
+
+PyGetSetDef mcts_getset[] = {
+  {"num_iterations", mcts_get_num_iterations, nullptr, "Iterations run.", nullptr},
+  {"num_nodes", mcts_get_num_nodes, nullptr, "Nodes added to the tree.", nullptr},
+  {nullptr, nullptr, nullptr, nullptr, nullptr},
+};
+
+PyType_Slot mcts_slots[] = {
+  {Py_tp_new, reinterpret_cast<void*>(mcts_new)},
+  {Py_tp_dealloc, reinterpret_cast<void*>(mcts_dealloc)},
+  {Py_tp_methods, mcts_methods},
+  {Py_tp_getset, mcts_getset},
+  {Py_tp_doc, const_cast<char*>("MCTS(env, seed=None): the C++ MCTS with the env's rollout policy.")},
+  {0, nullptr},
+};
+
+PyType_Spec mcts_spec = {
+  "pfmcts.MCTS", sizeof(mcts_object), 0, Py_TPFLAGS_DEFAULT, mcts_slots,
+};
+
+// Module functions.
+
+PyObject* py_same_game(PyObject*, PyObject* args, PyObject* kwargs) {
+  static const char* keywords[] = {"board", "seed", nullptr};
+  Py_buffer board{};
+  int seed = 32;
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|y*i", const_cast<char**>(keywords),
+        &board, &seed)) {
+    return nullptr;
+  }
+  if (!board.obj) {
+    return wrap_env(same_game_type(seed));
+  }
+  same_game_type::board_type tiles;
+  bool ok = board.len == Py_ssize_t(tiles.size());
+  if (ok) {
+    std::memcpy(tiles.data(), board.buf, tiles.size());
+  }
+  PyBuffer_Release(&board);
+  if (!ok) {
+    PyErr_Format(PyExc_ValueError, "a board has %d cells", int(tiles.size()));
+    return nullptr;
+  }
+  for (auto tile : tiles) {
+    if (int(tile) > same_game_type::num_colors) {
+      PyErr_Format(PyExc_ValueError, "tiles are colors 0..%d", same_game_type::num_colors);
+      return nullptr;
+    }
+  }
+  return wrap_env(same_game_type(tiles));
+}
+
+PyObject* py_sokoban(PyObject*, PyObject* args, PyObject* kwargs) {
+  static const char* keywords[] = {"level", "push", nullptr};
+  const char* level;
+  int push = 0;
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|p", const_cast<char**>(keywords),
+        &level, &push)) {
+    return nullptr;
+  }
+  try {
+    std::string text(level);
+    std::shared_ptr<const sokoban_level> lvl;
+    if (text.find('\n') == std::string::npos) {
+      lvl = sokoban_level::from_file(text);
+    } else {
+      std::vector<std::string> lines;
+      std::stringstream ss(text);
+      std::string line;
+      while (std::getline(ss, line)) {
+        lines.push_back(line);
+      }
+      lvl = std::make_shared<const sokoban_level>(lines);
+    }
+    return push ? wrap_env(sokoban_push_env(lvl)) : wrap_env(sokoban_env(lvl));
+  } catch (const std::exception& e) {
+    PyErr_SetString(PyExc_ValueError, e.what());
+    return nullptr;
+  }
+}
+
+// One playout of the env's rollout policy, as MCTS::default_policy plays.
+template <class Env>
+double play_out(Env env, std::mt19937& rng) {
+  typename Env::rollout_move_getter rmg(&env);
+  while (!env.is_game_over()) {
+    const auto& moves = rmg.get();
+    if (!moves.empty()) {
+      env.step(moves[rng() % moves.size()]);
+    }
+  }
+  return env.get_total_reward();
+}
+
+PyObject* py_rollouts(PyObject*, PyObject* args, PyObject* kwargs) {
+  static const char* keywords[] = {"env", "n", "seed", "threads", nullptr};
+  PyObject* env;
+  Py_ssize_t n;
+  unsigned long seed = 0;
+  unsigned threads = 1;
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!n|kI", const_cast<char**>(keywords),
+        env_type, &env, &n, &seed, &threads)) {
+    return nullptr;
+  }
+  if (n < 0) {
+    PyErr_SetString(PyExc_ValueError, "n must not be negative");
+    return nullptr;
+  }
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  std::vector<double> rewards(n);
+  env_variant start = env_of(env);
+  bool ok = without_gil([&]() {
+    std::visit([&](auto& e) {
+      // rollout i is seeded with seed + i, so results do not depend on
+      // the thread count
+      auto work = [&](unsigned t) {
+        for (Py_ssize_t i = t; i < n; i += threads) {
+          std::mt19937 rng(seed + i);
+          rewards[i] = play_out(e, rng);
+        }
+      };
+      std::vector<std::thread> workers;
+      for (unsigned t = 1; t < threads; t++) {
+        workers.emplace_back(work, t);
+      }
+      work(0);
+      for (auto& worker : workers) {
+        worker.join();
+      }
+    }, start);
+  });
+  if (!ok) {
+    return nullptr;
+  }
+  return make_array<double>(std::move(rewards));
+}
+
+PyMethodDef module_methods[] = {
+  {"same_game", reinterpret_cast<PyCFunction>(reinterpret_cast<void(*)()>(py_same_game)),
+    METH_VARARGS | METH_KEYWORDS,
+    "same_game(board=None, seed=32): a 15x15, 5 color board, random from seed or given as "
+    "225 bytes of colors 0..5 indexed x * 15 + y, y counted from the bottom."},
+  {"sokoban", reinterpret_cast<PyCFunction>(reinterpret_cast<void(*)()>(py_sokoban)),
+    METH_VARARGS | METH_KEYWORDS,
+    "sokoban(level, push=False): a level from a file path or its text, with single steps "
+    "or whole pushes as moves."},
+  {"rollouts", reinterpret_cast<PyCFunction>(reinterpret_cast<void(*)()>(py_rollouts)),
+    METH_VARARGS | METH_KEYWORDS,
+    "rollouts(env, n, seed=0, threads=1): the final rewards of n random playouts from env as "
+    "an Array, on threads threads (0 for all cores)."},
+  {nullptr, nullptr, 0, nullptr},
+};
+
+PyModuleDef module_def = {
+  PyModuleDef_HEAD_INIT, "pfmcts", "C++ envs and MCTS for the experiment scripts.", -1,
+  module_methods,
+};
+
+bool add_type(PyObject* module, PyType_Spec* spec, PyTypeObject*& type) {
+  type = reinterpret_cast<PyTypeObject*>(PyType_FromSpec(spec));
+  if (!type) {
+    return false;
+  }
+#if PY_VERSION_HEX < 0x030A0000
+  // without Py_TPFLAGS_DISALLOW_INSTANTIATION a type with no Py_tp_new
+  // would inherit object's, making objects its dealloc cannot free
+  bool has_new = false;
+  for (PyType_Slot* slot = spec->slots; slot->slot; slot++) {
+    has_new = has_new || slot->slot == Py_tp_new;
+  }
+  if (!has_new) {
+    type->tp_new = nullptr;
+  }
+#endif
+  const char* name = std::strrchr(spec->name, '.') + 1;
+  Py_INCREF(type);
+  if (PyModule_AddObject(module, name, reinterpret_cast<PyObject*>(type)) < 0) {
+    Py_DECREF(type);
+    return false;
+  }
+  return true;
+}
+
+}
+
+PyMODINIT_FUNC PyInit_pfmcts() {
+  PyObject* module = PyModule_Create(&module_def);
+  if (!module) {
+    return nullptr;
+  }
+  if (!add_type(module, &array_spec, array_type) || !add_type(module, &env_spec, env_type) ||
+      !add_type(module, &mcts_spec, mcts_type)) {
+    Py_DECREF(module);
+    return nullptr;
+  }
+  return module;
+}
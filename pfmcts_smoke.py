@@ -0,0 +1,83 @@
+# Quick check of the pfmcts bindings after a build: envs, moves in and
+# out, a short search, its tree statistics and rollouts. Prints ok or
+# stops at the first failed assertion.
+#
+#   make pfmcts && python3 pfmcts_smoke.py
+
+import pfmcts
+
+
+def raises(error, f, *args, **kwargs):
+    try:
+        f(*args, **kwargs)
+    except error:
+        return True
+    return False
+
+
+# same game: moves are (x, y) rows
+env = pfmcts.same_game(seed=32)
+moves = env.moves()
+assert moves.shape[1] == 2 and len(moves) > 0
+first = moves[0]
+assert len(first) == 2 and list(first) == moves.tolist()[0]
+assert memoryview(moves).format == 'h'
+
+env.copy().step(first)
+env.copy().step(tuple(first))
+env.copy().step(moves.tolist()[0])
+child = env.copy()
+child.step(first)
+assert child.num_steps == 1 and env.num_steps == 0
+assert child.total_reward >= 0
+assert child.seq().tolist() == [list(first)]
+
+assert raises(TypeError, env.step, 3)
+assert raises(TypeError, env.step, 'ab')
+assert raises(TypeError, env.step, (1.5, 2))
+assert raises(ValueError, env.step, (1, 2, 3))
+assert raises(ValueError, env.step, (1 << 40, 0))
+assert raises(ValueError, env.step, (-1, -1))
+assert raises(IndexError, lambda: moves[len(moves)])
+assert raises(TypeError, pfmcts.Array)
+assert raises(TypeError, type(env))
+
+board = bytes(1 + (i * 7 + i // 15) % 5 for i in range(225))
+assert pfmcts.same_game(board=board).moves().shape[1] == 2
+assert raises(ValueError, pfmcts.same_game, bytes(10))
+
+# search and tree statistics
+m = pfmcts.MCTS(env, seed=1)
+seq = m.search(iterations=200)
+assert len(seq) > 0 and m.num_iterations > 0 and m.num_nodes > 0
+played = env.copy()
+for move in seq:
+    played.step(move)
+assert played.num_steps == len(seq)
+stats = m.tree_stats()
+assert stats['arity'].shape[0] == len(stats['visits']) == len(stats['value'])
+assert stats['visits'][0] > 0
+assert raises(RuntimeError, m.search, iterations=10)
+assert raises(ValueError, pfmcts.MCTS(env).search)
+
+# rollouts do not depend on the thread count
+one = pfmcts.rollouts(env, 64, seed=3, threads=1).tolist()
+four = pfmcts.rollouts(env, 64, seed=3, threads=4).tolist()
+assert one == four and len(one) == 64
+
+# sokoban: steps are directions, pushes (cell, direction) rows
+steps = pfmcts.sokoban('skbn_cfgs/1.cfg')
+step = steps.moves()[0]
+assert isinstance(step, int)
+steps.step(step)
+assert raises(ValueError, steps.step, 99)
+
+pushes = pfmcts.sokoban('skbn_cfgs/1.cfg', push=True)
+push = pushes.moves()[0]
+pushes.copy().step(push)
+pushes.step(pushes.moves().tolist()[0])
+assert raises(ValueError, pushes.step, (push[0], 99))
+for move in pfmcts.MCTS(pushes, seed=1).search(iterations=50):
+    pushes.step(move)
+
+print('ok')
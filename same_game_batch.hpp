@@ -0,0 +1,301 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+// Plays Lanes independent random SameGame rollouts in lockstep. Boards are
+// stored struct-of-arrays, one vector of Lanes tiles per cell, and every
+// pass below is written with GCC vector types, so each compare, select and
+// min handles all lanes at once and every lane executes the same
+// instructions whether its game is still running or not. Finished lanes
+// are masked out instead of branched around.
+//
+// Components are found by min-label propagation (each tile takes the
+// smallest cell index among equal neighbours until nothing changes), which
+// labels every group by its first cell in scan order, the same cell the
+// scalar env reports as the group's move.
+template <class Env, int Lanes = 16>
+class same_game_batch {
+  public:
+    static constexpr int width = Env::width;
+    static constexpr int height = Env::height;
+    static constexpr int num_colors = Env::num_colors;
+    static constexpr int num_cells = Env::num_cells;
+    static constexpr int lanes = Lanes;
+    using move_type = typename Env::move_type;
+    // tiles, labels and counters share one element type so that masks from
+    // any compare can select any of them
+    using lane_type = std::conditional_t<(num_cells < 255), std::uint8_t, std::uint16_t>;
+    typedef lane_type vec __attribute__((vector_size(Lanes * sizeof(lane_type))));
+  private:
+    static constexpr lane_type none = std::numeric_limits<lane_type>::max();
+    static constexpr int max_moves = num_cells / 2 + 1;
+
+    // plain arrays: std::array<vec, N> would drop the vector attribute
+    vec tiles_[num_cells];
+    vec labels_[num_cells];
+    vec movable_[num_cells];
+    // columns past this one are empty in every lane
+    int num_columns_;
+    std::array<std::uint32_t, Lanes> rng_;
+    std::array<int, Lanes> reward_;
+    vec done_;
+    vec avoid_;
+    std::array<short, Lanes> num_moves_;
+    std::array<std::array<lane_type, max_moves>, Lanes> moves_;
+
+    static constexpr int index(int x, int y) {
+      return x * height + y;
+    }
+
+    static vec splat(lane_type value) {
+      vec v = {};
+      return v + value;
+    }
+
+    static vec select(vec m, vec a, vec b) {
+      return (m & a) | (~m & b);
+    }
+
+    static bool any(vec v) {
+      for (int l = 0; l < Lanes; l++) {
+        if (v[l]) {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    void label() {
+      const vec empty = splat(0);
+      const vec unset = splat(none);
+      for (int cell = 0; cell < index(num_columns_, 0); cell++) {
+        labels_[cell] = select((vec)(tiles_[cell] == empty), unset, splat(cell));
+      }
+
+      // relax against an equal neighbour; empty cells compare equal to each
+      // other but both carry `none`, so they never leak into real groups
+      vec changed;
+      auto relax = [&](int cell, int other) {
+        vec from = select((vec)(tiles_[cell] == tiles_[other]), labels_[other], unset);
+        vec smaller = (vec)(from < labels_[cell]);
+        changed |= smaller;
+        labels_[cell] = select(smaller, from, labels_[cell]);
+      };
+
+      do {
+        changed = empty;
+        for (int x = 0; x < num_columns_; x++) {
+          for (int y = 0; y < height; y++) {
+            if (y > 0) {
+              relax(index(x, y), index(x, y - 1));
+            }
+            if (x > 0) {
+              relax(index(x, y), index(x - 1, y));
+            }
+          }
+        }
+        for (int x = num_columns_ - 1; x >= 0; x--) {
+          for (int y = height - 1; y >= 0; y--) {
+            if (y + 1 < height) {
+              relax(index(x, y), index(x, y + 1));
+            }
+            if (x + 1 < num_columns_) {
+              relax(index(x, y), index(x + 1, y));
+            }
+          }
+        }
+      } while (any(changed));
+    }
+
+    // Chooses a move per lane: the first cell of a group with an equal
+    // neighbour (which is always above or to the right of the first cell),
+    // skipping the lane's tabu color while it has other moves. Lanes with
+    // nothing to play get `none`.
+    vec choose() {
+      const vec empty = splat(0);
+      vec count_all = empty;
+      vec count_ok = empty;
+      for (int x = 0; x < num_columns_; x++) {
+        for (int y = 0; y < height; y++) {
+          int cell = index(x, y);
+          vec tile = tiles_[cell];
+          vec pair = empty;
+          if (y + 1 < height) {
+            pair |= (vec)(tile == tiles_[cell + 1]);
+          }
+          if (x + 1 < width) {
+            pair |= (vec)(tile == tiles_[cell + height]);
+          }
+          vec movable = (vec)(labels_[cell] == splat(cell)) & pair
+            & (vec)(tile != empty) & ~done_;
+          movable_[cell] = movable;
+          count_all -= movable;
+          count_ok -= movable & (vec)(tile != avoid_);
+        }
+      }
+
+      vec use_all = (vec)(count_ok == empty);
+      vec count = select(use_all, count_all, count_ok);
+      vec target;
+      for (int l = 0; l < Lanes; l++) {
+        rng_[l] ^= rng_[l] << 13;
+        rng_[l] ^= rng_[l] >> 17;
+        rng_[l] ^= rng_[l] << 5;
+        target[l] = ((rng_[l] >> 16) * count[l]) >> 16;
+      }
+
+      vec chosen = splat(none);
+      vec seen = empty;
+      for (int cell = 0; cell < index(num_columns_, 0); cell++) {
+        vec eligible = movable_[cell] & (use_all | (vec)(tiles_[cell] != avoid_));
+        chosen = select(eligible & (vec)(seen == target), splat(cell), chosen);
+        seen -= eligible;
+      }
+      return chosen;
+    }
+
+    void collapse() {
+      const vec empty = splat(0);
+      for (int x = 0; x < num_columns_; x++) {
+        vec changed;
+        do {
+          changed = empty;
+          for (int y = 0; y + 1 < height; y++) {
+            vec& lower = tiles_[index(x, y)];
+            vec& upper = tiles_[index(x, y + 1)];
+            vec fall = (vec)(lower == empty) & (vec)(upper != empty);
+            changed |= fall;
+            lower = select(fall, upper, lower);
+            upper = select(fall, empty, upper);
+          }
+        } while (any(changed));
+      }
+
+      vec changed;
+      do {
+        changed = empty;
+        for (int x = 0; x + 1 < num_columns_; x++) {
+          vec shift = (vec)(tiles_[index(x, 0)] == empty)
+            & (vec)(tiles_[index(x + 1, 0)] != empty);
+          if (!any(shift)) {
+            continue;
+          }
+          changed |= shift;
+          for (int y = 0; y < height; y++) {
+            vec& left = tiles_[index(x, y)];
+            vec& right = tiles_[index(x + 1, y)];
+            left = select(shift, right, left);
+            right = select(shift, empty, right);
+          }
+        }
+      } while (any(changed));
+
+      while (num_columns_ > 0 && !any(tiles_[index(num_columns_ - 1, 0)])) {
+        num_columns_--;
+      }
+    }
+
+    void finish(int l) {
+      done_[l] = none;
+      if (tiles_[0][l] == 0) {
+        reward_[l] += 1000;
+        return;
+      }
+      std::array<int, num_colors + 1> num_left{};
+      for (int cell = 0; cell < num_cells; cell++) {
+        num_left[tiles_[cell][l]]++;
+      }
+      for (int color = 1; color <= num_colors; color++) {
+        if (num_left[color] > 2) {
+          reward_[l] -= (num_left[color] - 2) * (num_left[color] - 2);
+        }
+      }
+    }
+  public:
+    // Copies env into lane l; its reward so far is carried into the rollout.
+    void load(int l, const Env& env) {
+      for (int x = 0; x < width; x++) {
+        for (int y = 0; y < height; y++) {
+          tiles_[index(x, y)][l] = env.get_tile(x, y);
+        }
+      }
+      reward_[l] = env.get_total_reward();
+      num_columns_ = width;
+      done_[l] = env.is_game_over() ? none : 0;
+      num_moves_[l] = 0;
+    }
+
+    void load(const Env& env) {
+      for (int l = 0; l < Lanes; l++) {
+        load(l, env);
+      }
+    }
+
+    // Plays every lane to the end and returns the final total rewards. With
+    // tabu set, each lane avoids its most common color the way
+    // Env::tabu_move_getter does.
+    template <class Rng>
+    const std::array<int, Lanes>& rollout(Rng& rng, bool tabu = false) {
+      avoid_ = splat(0);
+      for (int l = 0; l < Lanes; l++) {
+        rng_[l] = rng() | 1;
+        if (tabu) {
+          std::array<int, num_colors + 1> color_ct{};
+          for (int cell = 0; cell < num_cells; cell++) {
+            color_ct[tiles_[cell][l]]++;
+          }
+          color_ct[0] = 0;
+          avoid_[l] = std::max_element(color_ct.begin(), color_ct.end()) - color_ct.begin();
+        }
+      }
+
+      const vec empty = splat(0);
+      while (true) {
+        label();
+        vec chosen = choose();
+
+        bool running = false;
+        for (int l = 0; l < Lanes; l++) {
+          if (done_[l]) {
+            continue;
+          }
+          if (chosen[l] == none) {
+            finish(l);
+          } else {
+            running = true;
+            moves_[l][num_moves_[l]++] = chosen[l];
+          }
+        }
+        if (!running) {
+          break;
+        }
+
+        vec removed = empty;
+        for (int cell = 0; cell < index(num_columns_, 0); cell++) {
+          vec hit = (vec)(labels_[cell] == chosen) & (vec)(tiles_[cell] != empty);
+          removed -= hit;
+          tiles_[cell] = select(hit, empty, tiles_[cell]);
+        }
+        for (int l = 0; l < Lanes; l++) {
+          int n = removed[l];
+          reward_[l] += n ? (n - 2) * (n - 2) : 0;
+        }
+
+        collapse();
+      }
+      return reward_;
+    }
+
+    // Moves played in lane l by the last rollout, in the env's coordinates.
+    std::vector<move_type> get_seq(int l) const {
+      std::vector<move_type> seq;
+      for (int i = 0; i < num_moves_[l]; i++) {
+        seq.push_back(move_type(moves_[l][i] / height, moves_[l][i] % height));
+      }
+      return seq;
+    }
+};
@@ -0,0 +1,176 @@
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include "mcts.hpp"
+#include "same_game_env.hpp"
+#include "same_game_positions.hpp"
+#include "search.hpp"
+
+// Runs an engine on every position of a test set under a fixed time budget,
+// one position per core at a time, and reports the score per position, the
+// total score and the iteration throughput.
+//
+//   same_game_bench <positions> [seconds=10] [threads=all] [engine=mcts]
+//   same_game_bench --generate <count> [seed=1] > positions
+
+using env_type = standard_same_game_env;
+using move_type = env_type::move_type;
+
+struct engine_result {
+  std::vector<move_type> seq;
+  std::size_t iterations;
+};
+
+using engine_type = std::function<engine_result(const env_type&, double, unsigned)>;
+
+static const std::map<std::string, engine_type> engines = {
+  {"mcts", [](const env_type& env, double seconds, unsigned seed) {
+    MCTS<env_type> mcts(env, seed);
+    auto seq = mcts.search_for(seconds);
+    return engine_result{seq, mcts.get_num_iterations()};
+  }},
+  {"mcts-tabu", [](const env_type& env, double seconds, unsigned seed) {
+    MCTS<env_type, env_type::tabu_move_getter> mcts(env, seed);
+    auto seq = mcts.search_for(seconds);
+    return engine_result{seq, mcts.get_num_iterations()};
+  }},
+  {"mcts-tabu-batch", [](const env_type& env, double seconds, unsigned seed) {
+    MCTS<env_type, env_type::tabu_move_getter> mcts(env, seed);
+    mcts.set_leaf_parallel(true);
+    auto seq = mcts.search_for(seconds);
+    return engine_result{seq, mcts.get_num_iterations()};
+  }},
+  {"mcts-cache", [](const env_type& env, double seconds, unsigned seed) {
+    env_type::component_cache cache(1 << 15);
+    env_type start(env);
+    start.set_component_cache(&cache);
+    MCTS<env_type> mcts(start, seed);
+    auto seq = mcts.search_for(seconds);
+    return engine_result{seq, mcts.get_num_iterations()};
+  }},
+  // leaves evaluated by a surrogate fitted to 1000 random games first
+  {"mcts-model", [](const env_type& env, double seconds, unsigned seed) {
+    auto start = std::chrono::steady_clock::now();
+    std::mt19937 rng(seed);
+    game_model model(sample_rollouts(env, 1000, rng));
+    std::chrono::duration<double> fitting = std::chrono::steady_clock::now() - start;
+    MCTS<env_type> mcts(env, seed);
+    mcts.set_rollout_model(&model);
+    auto seq = mcts.search_for(std::max(0.0, seconds - fitting.count()));
+    return engine_result{seq, mcts.get_num_iterations()};
+  }},
+  // rollouts on every other core, so run it with threads=1
+  {"mcts-pipelined", [](const env_type& env, double seconds, unsigned seed) {
+    MCTS<env_type> mcts(env, seed);
+    unsigned workers = std::max(2u, std::thread::hardware_concurrency()) - 1;
+    auto seq = mcts.search_pipelined(seconds, workers);
+    return engine_result{seq, mcts.get_num_iterations()};
+  }},
+  // iterations are expanded states for the two baselines
+  {"best-first", [](const env_type& env, double seconds, unsigned) {
+    auto res = best_first(env, 100000, std::numeric_limits<std::size_t>::max(), seconds);
+    return engine_result{res.seq, res.num_expanded};
+  }},
+  {"beam", [](const env_type& env, double seconds, unsigned) {
+    auto res = beam_search(env, 1000, 1, seconds);
+    return engine_result{res.seq, res.num_expanded};
+  }},
+};
+
+struct position_result {
+  double score = 0;
+  std::size_t iterations = 0;
+  double seconds = 0;
+};
+
+int main(int argc, char** argv) {
+  if (argc > 2 && std::string(argv[1]) == "--generate") {
+    int count = std::stoi(argv[2]);
+    unsigned seed = argc > 3 ? std::stoul(argv[3]) : 1;
+    for (int i = 0; i < count; i++) {
+      write_same_game_position(std::cout, random_same_game_position<env_type>(seed + i));
+    }
+    return 0;
+  }
+
+  if (argc < 2) {
+    std::cerr << "usage: " << argv[0] << " <positions> [seconds] [threads] [engine]" << std::endl
+      << "       " << argv[0] << " --generate <count> [seed]" << std::endl;
+    return 1;
+  }
+
+  std::vector<env_type> positions;
+  try {
+    positions = load_same_game_positions<env_type>(argv[1]);
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  double seconds = argc > 2 ? std::stod(argv[2]) : 10;
+  unsigned num_threads = argc > 3 ? std::stoul(argv[3]) : std::thread::hardware_concurrency();
+  std::string engine_name = argc > 4 ? argv[4] : "mcts";
+  num_threads = std::max(1u, num_threads);
+
+  auto engine_it = engines.find(engine_name);
+  if (engine_it == engines.end()) {
+    std::cerr << "unknown engine " << engine_name << ", choose one of:";
+    for (auto& engine : engines) {
+      std::cerr << " " << engine.first;
+    }
+    std::cerr << std::endl;
+    return 1;
+  }
+  const engine_type& engine = engine_it->second;
+
+  std::vector<position_result> results(positions.size());
+  std::atomic<std::size_t> next(0);
+  std::vector<std::thread> workers;
+  for (unsigned t = 0; t < num_threads; t++) {
+    workers.emplace_back([&]() {
+      for (std::size_t i = next++; i < positions.size(); i = next++) {
+        auto start = std::chrono::steady_clock::now();
+        engine_result res = engine(positions[i], seconds, i + 1);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        // score the returned sequence on a fresh copy so that a bad engine
+        // cannot report a score it did not play
+        env_type env(positions[i]);
+        for (auto& move : res.seq) {
+          env.step(move);
+        }
+        results[i] = {env.get_total_reward(), res.iterations, elapsed.count()};
+      }
+    });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+
+  double total_score = 0;
+  std::size_t total_iterations = 0;
+  double total_seconds = 0;
+  std::cout << "engine: " << engine_name << ", " << seconds << "s per position, "
+    << num_threads << " threads" << std::endl;
+  std::cout << std::setw(4) << "pos" << std::setw(10) << "score"
+    << std::setw(14) << "iterations" << std::setw(14) << "iters/s" << std::endl;
+  for (std::size_t i = 0; i < results.size(); i++) {
+    const position_result& res = results[i];
+    std::cout << std::setw(4) << i + 1 << std::setw(10) << res.score
+      << std::setw(14) << res.iterations
+      << std::setw(14) << std::fixed << std::setprecision(0) << res.iterations / res.seconds
+      << std::endl;
+    total_score += res.score;
+    total_iterations += res.iterations;
+    total_seconds += res.seconds;
+  }
+  std::cout << "total score: " << total_score << std::endl;
+  std::cout << "iterations/s: " << total_iterations / total_seconds << std::endl;
+}
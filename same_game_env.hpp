@@ -4,13 +4,13 @@
 #include <cassert>
 #include <cstdlib>
 #include <iostream>
-#include <map>
-#include <set>
-#include <sstream>
 #include <string>
-#include <unordered_map>
 #include <utility>
 #include <vector>
+#include "bounded_cache.hpp"
+
+template <class Env, int Lanes>
+class same_game_batch;
 
 struct pair_hash {
   template <class T1, class T2>
@@ -21,47 +21,205 @@ struct pair_hash {
   }
 };
 
-class same_game_env {
+// SameGame with the board geometry and color count fixed at compile time.
+// Tiles are stored column-major in a flat array (index x * Height + y) so
+// that gravity and column removal are contiguous copies, and every loop
+// bound below is a constant the compiler can unroll.
+template <int Width, int Height, int NumColors>
+class basic_same_game_env {
+  static_assert(Width > 0 && Height > 0, "board must have at least one cell");
+  static_assert(NumColors > 0 && NumColors < 10, "colors are single digits");
   public:
-    using board_type = std::vector<std::vector<short>>;
+    static constexpr int width = Width;
+    static constexpr int height = Height;
+    static constexpr int num_colors = NumColors;
+    static constexpr int num_cells = Width * Height;
+    using tile_type = unsigned char;
+    using board_type = std::array<tile_type, num_cells>;
     using position_type = std::pair<short, short>;
     using move_type = position_type;
-    using move_to_adj_map = std::map<position_type, std::vector<position_type>>;
+    // lockstep rollouts for leaf-parallel search, see same_game_batch.hpp
+    using batch_type = same_game_batch<basic_same_game_env, 16>;
+
+    // The component labels and moves of a board, which are all step
+    // derives from it. A component_cache shared by the envs of one search
+    // maps boards to them, so a board reached again, by a transposition or
+    // a repeated rollout prefix, is not labelled again.
+    struct components {
+      std::array<short, num_cells> group;
+      std::vector<position_type> moves;
+    };
+    using component_cache = bounded_cache<board_type, components>;
   private:
-    int num_colors_ = 5;
     int total_reward_ = 0;
     int curr_reward_ = 0;
     board_type board_;
-    move_to_adj_map moves_and_connected_ = {};
-    int width = 12;
+    // component of every cell, labelled by the index of its first cell in
+    // scan order (which is also the position reported as its move)
+    std::array<short, num_cells> group_;
+    std::vector<position_type> moves_;
     std::vector<position_type> sequence_;
+    // null unless set_component_cache was called; copies share it
+    const component_cache* cache_ = nullptr;
+
+    static constexpr int index(int x, int y) {
+      return x * Height + y;
+    }
+
+    static position_type to_position(int idx) {
+      return position_type(idx / Height, idx % Height);
+    }
+
+    // Flood fills the component containing idx, marking its cells in seen
+    // and calling visit on each. Membership is decided by the board alone,
+    // so it works while the labels are stale.
+    template <class Visit>
+    int flood(int idx, std::array<bool, num_cells>& seen, Visit visit) const {
+      std::array<short, num_cells> stack;
+      tile_type color = board_[idx];
+      int top = 0;
+      int count = 0;
+      stack[top++] = idx;
+      seen[idx] = true;
+      while (top) {
+        int cur = stack[--top];
+        visit(cur);
+        count++;
+        int x = cur / Height;
+        int y = cur % Height;
+        if (y + 1 < Height && !seen[cur + 1] && board_[cur + 1] == color) {
+          seen[cur + 1] = true;
+          stack[top++] = cur + 1;
+        }
+        if (y > 0 && !seen[cur - 1] && board_[cur - 1] == color) {
+          seen[cur - 1] = true;
+          stack[top++] = cur - 1;
+        }
+        if (x + 1 < Width && !seen[cur + Height] && board_[cur + Height] == color) {
+          seen[cur + Height] = true;
+          stack[top++] = cur + Height;
+        }
+        if (x > 0 && !seen[cur - Height] && board_[cur - Height] == color) {
+          seen[cur - Height] = true;
+          stack[top++] = cur - Height;
+        }
+      }
+      return count;
+    }
+
+    // Relabels every component with a tile in columns [lo, hi] that is not
+    // yet marked in done, appending its move if it has one. A component may
+    // reach outside the columns; all of its cells are relabelled.
+    void label_columns(int lo, int hi, std::array<bool, num_cells>& done) {
+      std::array<short, num_cells> cells;
+      for (int x = lo; x <= hi; x++) {
+        for (int y = 0; y < Height; y++) {
+          int idx = index(x, y);
+          if (board_[idx] == 0) {
+            std::fill(group_.begin() + idx, group_.begin() + index(x + 1, 0), -1);
+            break;
+          }
+          if (done[idx]) {
+            continue;
+          }
+          int size = 0;
+          int first = idx;
+          flood(idx, done, [&](int cell) {
+            cells[size++] = cell;
+            first = std::min(first, cell);
+          });
+          for (int i = 0; i < size; i++) {
+            group_[cells[i]] = first;
+          }
+          if (size > 1) {
+            moves_.push_back(to_position(first));
+          }
+        }
+      }
+    }
+
+    void label_groups() {
+      std::array<bool, num_cells> done{};
+      moves_.clear();
+      label_columns(0, Width - 1, done);
+    }
+
+    // Gravity on columns [lo, hi], which must hold every removed tile, then
+    // closes the columns that emptied. Labels travel with their tiles.
+    // Returns the number of columns closed.
+    int collapse(int lo, int hi) {
+      int num_empty = 0;
+      for (int x = lo; x <= hi; x++) {
+        tile_type* col = &board_[index(x, 0)];
+        short* labels = &group_[index(x, 0)];
+        int filled = 0;
+        for (int y = 0; y < Height; y++) {
+          if (col[y]) {
+            labels[filled] = labels[y];
+            col[filled++] = col[y];
+          }
+        }
+        std::fill(col + filled, col + Height, 0);
+        std::fill(labels + filled, labels + Height, -1);
+        num_empty += filled == 0;
+      }
+
+      if (num_empty == 0) {
+        return 0;
+      }
+
+      int filled = lo;
+      for (int x = lo; x < Width; x++) {
+        if (board_[index(x, 0)] == 0) {
+          continue;
+        }
+        if (filled != x) {
+          int shift = (x - filled) * Height;
+          std::copy_n(&board_[index(x, 0)], Height, &board_[index(filled, 0)]);
+          for (int y = 0; y < Height; y++) {
+            short label = group_[index(x, y)];
+            group_[index(filled, y)] = label == -1 ? -1 : label - shift;
+          }
+        }
+        filled++;
+      }
+      std::fill(board_.begin() + index(filled, 0), board_.end(), 0);
+      std::fill(group_.begin() + index(filled, 0), group_.end(), -1);
+      return num_empty;
+    }
   public:
-    same_game_env(int random_seed = 32) {
+    basic_same_game_env(int random_seed = 32) {
       std::srand(random_seed);
-      for (int x = 0; x < width; x++) {
-        board_.push_back({});
-        for (int y = 0; y < width; y++) {
-          board_[x].push_back((std::rand() % 5) + 1);
+      for (int x = 0; x < Width; x++) {
+        for (int y = 0; y < Height; y++) {
+          board_[index(x, y)] = (std::rand() % NumColors) + 1;
         }
       }
-      get_possible_moves();
+      label_groups();
+    }
+
+    // Tiles may float; gravity and column removal are applied on load.
+    basic_same_game_env(const board_type& board)
+      : board_(board)
+    {
+      group_.fill(-1);
+      collapse();
+      label_groups();
     }
-    
-    same_game_env(const same_game_env& other) 
-      : board_(other.board_), total_reward_(other.total_reward_),
-        curr_reward_(other.curr_reward_), 
-        moves_and_connected_(other.moves_and_connected_),
-        sequence_(other.sequence_)
-    {}
 
     std::size_t hash() const {
-      std::stringstream ss;
-      for (int i = 0; i < board_.size(); i++) {
-        for (int j = 0; j < board_[i].size(); j++) {
-          ss << board_[i][j];
-        }
+      // FNV-1a over the tiles
+      std::size_t h = 14695981039346656037ULL;
+      for (tile_type tile : board_) {
+        h = (h ^ tile) * 1099511628211ULL;
       }
-      return std::hash<std::string>{}(ss.str());
+      return h;
+    }
+
+    // Looks boards up in cache, which must outlive this env and its copies,
+    // after every step; null turns the lookups off.
+    void set_component_cache(const component_cache* cache) {
+      cache_ = cache;
     }
 
     double get_curr_reward() const {
@@ -80,6 +238,10 @@ class same_game_env {
       return sequence_.size();
     }
 
+    tile_type get_tile(int x, int y) const {
+      return board_[index(x, y)];
+    }
+
     void print_seq() const {
       std::cout << "seq: ";
       for (auto it = sequence_.begin(); it != sequence_.end(); ++it) {
@@ -87,13 +249,13 @@ class same_game_env {
       }
       std::cout << std::endl;
     }
-      
-    void render() {
+
+    void render() const {
       std::cout << "*********************************" << std::endl;
-      for (int y = width - 1; y >= 0; y--) {
+      for (int y = Height - 1; y >= 0; y--) {
         std::cout << "| ";
-        for (int x = 0; x < width; x++) {
-          short tile = board_[x][y];
+        for (int x = 0; x < Width; x++) {
+          int tile = board_[index(x, y)];
           std::cout << "\033[9" << tile << "m" << tile << "\033[0m ";
         }
         std::cout << "|" << std::endl;
@@ -102,120 +264,29 @@ class same_game_env {
     }
 
     bool is_game_over() const {
-      for (int x = 0; x < width; x++) {
-        for (int y = 0; y < width; y++) {
-          short tile = board_[x][y];
-          if (tile == 0) {
-            break;
-          }
-          if (y + 1 < width && board_[x][y+1] == tile) {
-            return false;
-          }
-          if (x + 1 < width && board_[x+1][y] == tile) {
-            return false;
-          }
-        }
-      }
-      return true;
+      return moves_.empty();
     }
 
     bool is_board_empty() const {
-      for (auto it = board_.cbegin(); it != board_.cend(); ++it) {
-        const std::vector<short>& col = *it;
-        bool all_zero = std::all_of(col.begin(), col.end(), 
-          [](short i) { return i == 0; });
-        if (!all_zero) {
-          return false;
-        }
-      }
-      return true;
-    }
-
-    std::set<position_type> aggregate(const position_type& cur, move_to_adj_map& adj) {
-      std::set<position_type> connected;
-      std::vector<position_type>& adjacents = adj[cur]; 
-
-      for (auto it = adjacents.begin(); it != adjacents.end(); ++it) {
-        connected.insert(*it);
-        std::set<position_type> tmp = aggregate(*it, adj);
-        connected.insert(tmp.begin(), tmp.end());
-      }
-      return connected;
+      // gravity and column removal keep the bottom-left tile occupied
+      // as long as anything is left
+      return board_[0] == 0;
     }
 
-    std::set<position_type> find_adj(position_type pos, std::set<position_type>& adjacent) {
-      adjacent.insert(pos);
-      int x = pos.first;
-      int y = pos.second;
-
-      auto cur = board_[x][y];
-
-      position_type up(x, y+1);
-      position_type right(x+1, y);
-      position_type down(x, y-1);
-      position_type left(x-1, y);
-
-      if (!adjacent.count(up) && up.second < width && board_[up.first][up.second] == cur) {
-        find_adj(up, adjacent);
-      } 
-
-      if (!adjacent.count(right) && right.first < width && board_[right.first][right.second] == cur) {
-        find_adj(right, adjacent);
-      }
-
-      if (!adjacent.count(down) && down.second >= 0 && board_[down.first][down.second] == cur) {
-        find_adj(down, adjacent);
-      }
-
-      if (!adjacent.count(left) && left.first >= 0 && board_[left.first][left.second] == cur) {
-        find_adj(left, adjacent);
-      } 
-
-      return adjacent;
+    std::vector<position_type> get_possible_moves() const {
+      return moves_;
     }
 
-
-    std::vector<position_type> get_possible_moves() {
-      moves_and_connected_.clear();
-      move_to_adj_map adj = {};
-      std::set<position_type> covered;
-      std::vector<position_type> moves;
-      for (int x = 0; x < width; x++) {
-        for (int y = 0; y < width; y++) {
-          short tile = board_[x][y];
-          if (tile == 0) {
-            break;
-          }
-          position_type cur(x, y);
-          if (covered.count(cur)) {
-            continue;
-          } 
-
-          std::set<position_type> adjacent;
-          find_adj(cur, adjacent);
-
-          if (adjacent.size() > 1) {
-            if (!moves_and_connected_.count(cur)) {
-              moves_and_connected_[cur] = {};
-            }
-            moves.push_back(cur);
-            covered.insert(adjacent.begin(), adjacent.end());
-            adjacent.erase(adjacent.find(std::make_pair(x,y)));
-            std::copy(adjacent.begin(), adjacent.end(), 
-              std::back_inserter(moves_and_connected_[cur]));
-          }
-        }
-      }
-
-      return moves;
+    const std::vector<position_type>& get_moves() const {
+      return moves_;
     }
 
-    short get_most_common_color() {
-      std::array<int, 6> color_ct;
+    short get_most_common_color() const {
+      std::array<int, NumColors + 1> color_ct;
       color_ct.fill({});
-      for (int x = 0; x < width; x++) {
-        for (int y = 0; y < width; y++) {
-          short tile = board_[x][y];
+      for (int x = 0; x < Width; x++) {
+        for (int y = 0; y < Height; y++) {
+          tile_type tile = board_[index(x, y)];
           if (tile == 0) {
             break;
           }
@@ -225,94 +296,82 @@ class same_game_env {
       return std::distance(color_ct.begin(), std::max_element(color_ct.begin(), color_ct.end()));
     }
 
-    std::vector<position_type> get_rollout_moves(short avoid_color = 0) {
-      std::vector<position_type> all_moves = get_possible_moves();
-      std::vector<position_type> try_avoid;
-      for (auto it = all_moves.begin(); it != all_moves.end(); ++it) {
-        int x = it->first;
-        int y = it->second;
-        if (board_[x][y] != avoid_color) {
-          try_avoid.push_back(*it);
-        }      
-      }
-
-      if (try_avoid.empty()) {
-        return all_moves;
-      } else {
-        return try_avoid;
-      }
-    }
-
     void collapse() {
-      for (int x = 0; x < width; x++) {
-        std::vector<short>& col = board_[x];
-        for (auto it = col.begin(); it != col.end();) {
-          if (*it == 0) {
-            it = col.erase(it);
-          } else {
-            ++it;
-          }
-        }
-        int num_to_fill = width - col.size();
-        col.insert(col.end(), num_to_fill, 0);
-      }
-
-      for (auto it = board_.begin(); it != board_.end();) {
-        std::vector<short>& col = *it;
-        bool all_zero = std::all_of(col.begin(), col.end(), 
-          [](short i) { return i == 0; });
-        if (all_zero) {
-          it = board_.erase(it);
-        } else {
-          ++it;
-        }
-      }
-      
-      
-      int num_to_fill = width - board_.size();
-      std::vector<short> to_fill(width, 0);
-      board_.insert(board_.end(), num_to_fill, to_fill);
+      collapse(0, Width - 1);
     }
 
     void step(position_type pos) {
-      assert(moves_and_connected_.count(pos));
+      int idx = index(pos.first, pos.second);
+      assert(board_[idx] && group_[idx] == idx);
       sequence_.push_back(pos);
-      const std::vector<position_type>& adj_tiles = moves_and_connected_[pos];
 
-      board_[pos.first][pos.second] = 0;
-      for (auto it = adj_tiles.begin(); it != adj_tiles.end(); ++it) {
-        const position_type& tile = *it;
-        board_[tile.first][tile.second] = 0;
+      std::array<bool, num_cells> seen{};
+      int lo = Width;
+      int hi = -1;
+      int num_removed = flood(idx, seen, [&](int cell) {
+        board_[cell] = 0;
+        lo = std::min(lo, cell / Height);
+        hi = std::max(hi, cell / Height);
+      });
+      int reward = (num_removed - 2) * (num_removed - 2);
+
+      // Only components touching the removed columns or their neighbours can
+      // change; the rest keep their labels and moves, shifted left by the
+      // number of columns that emptied.
+      int dirty_lo = std::max(lo - 1, 0);
+      int dirty_hi = std::min(hi + 1, Width - 1);
+      std::array<bool, num_cells> dirty{};
+      for (int cell = index(dirty_lo, 0); cell < index(dirty_hi + 1, 0); cell++) {
+        if (group_[cell] != -1) {
+          dirty[group_[cell]] = true;
+        }
       }
 
-      int num_removed = adj_tiles.size();
-      int reward = std::pow(num_removed - 2, 2);
-      collapse();
-      bool game_over = is_game_over();
+      int num_closed = collapse(lo, hi);
 
-      if (game_over) {
+      static thread_local components found;
+      std::size_t board_hash = cache_ ? hash() : 0;
+      if (cache_ && cache_->find(board_, board_hash, found)) {
+        group_ = found.group;
+        moves_ = found.moves;
+      } else {
+        moves_.erase(std::remove_if(moves_.begin(), moves_.end(),
+          [&](const position_type& move) { return dirty[index(move.first, move.second)]; }),
+          moves_.end());
+        for (auto& move : moves_) {
+          if (move.first > hi) {
+            move.first -= num_closed;
+          }
+        }
+        std::array<bool, num_cells> done{};
+        label_columns(dirty_lo, dirty_hi - num_closed, done);
+        std::sort(moves_.begin(), moves_.end());
+        if (cache_) {
+          found.group = group_;
+          found.moves = moves_;
+          cache_->insert(board_, board_hash, found);
+        }
+      }
+
+      if (is_game_over()) {
         if (is_board_empty()) {
           reward += 1000;
         } else {
-          std::array<int, 5> num_left;
+          std::array<int, NumColors + 1> num_left;
           num_left.fill({});
-          for (int x = 0; x < width; x++) {
-            for (int y = 0; y < width; y++) { 
-              short color = board_[x][y];
-              if (color) {
-                num_left[color]++;
-              }
-            } 
+          for (tile_type color : board_) {
+            if (color) {
+              num_left[color]++;
+            }
           }
           for (auto it = num_left.begin(); it != num_left.end(); ++it) {
             if (*it > 2) {
-              reward -= std::pow(*it - 2, 2);
+              reward -= (*it - 2) * (*it - 2);
             }
           }
         }
       }
 
-      get_possible_moves();
       curr_reward_ = reward;
       total_reward_ += reward;
     }
@@ -321,19 +380,55 @@ class same_game_env {
       return std::make_pair(-1, -1);
     }
 
+    // Uniform random rollouts: every legal move is a candidate.
     class rollout_move_getter {
       private:
-        same_game_env* parent_;
+        basic_same_game_env* parent_;
+      public:
+        static constexpr bool tabu_color = false;
+
+        rollout_move_getter(basic_same_game_env* parent)
+          : parent_(parent)
+        {
+        }
+
+        const std::vector<move_type>& get() {
+          return parent_->get_moves();
+        }
+    };
+
+    // Tabu-color rollouts: the most common color at the start of the rollout
+    // is never played while another color still has a move, so its groups
+    // keep growing and are cleared late in one large, high-scoring move.
+    // The allowed moves are filtered from the env's move list, which is
+    // already up to date after every step, into a buffer that keeps its
+    // capacity, so a rollout neither rescans the board nor allocates past
+    // its first few steps. On 15x15 boards the filter is about 140 ns of a
+    // 2.2 us step (some 20 moves, 6%), which bounds what per-color move
+    // lists could save; step would have to keep those up on every move,
+    // tabu rollout or not.
+    class tabu_move_getter {
+      private:
+        basic_same_game_env* parent_;
         short avoid_color_;
+        std::vector<move_type> allowed_;
       public:
-        rollout_move_getter(same_game_env* parent) 
+        static constexpr bool tabu_color = true;
+
+        tabu_move_getter(basic_same_game_env* parent)
           : parent_(parent),
             avoid_color_(parent_->get_most_common_color())
         {
         }
 
-        std::vector<move_type> get() {
-          return parent_->get_possible_moves();
+        const std::vector<move_type>& get() {
+          allowed_.clear();
+          for (const move_type& move : parent_->get_moves()) {
+            if (parent_->get_tile(move.first, move.second) != avoid_color_) {
+              allowed_.push_back(move);
+            }
+          }
+          return allowed_.empty() ? parent_->get_moves() : allowed_;
         }
     };
 
@@ -341,3 +436,8 @@ class same_game_env {
       return rollout_move_getter(this);
     }
 };
+
+#include "same_game_batch.hpp"
+
+using same_game_env = basic_same_game_env<12, 12, 5>;
+using standard_same_game_env = basic_same_game_env<15, 15, 5>;
@@ -74,12 +74,13 @@ class Env(gym.Env):
                     return False 
         return True
 
-    def _aggregate(self, key, adj_dict):
-        s = set()
-        if key in adj_dict:
-            for elem in adj_dict[key]:
+    def _aggregate(self, key, adj_dict, seen=None):
+        # flood fill; edges are stored both ways, so the group includes key
+        s = set() if seen is None else seen
+        for elem in adj_dict.get(key, ()):
+            if elem not in s:
                 s.add(elem)
-                s = s.union(self._aggregate(elem, adj_dict))
+                self._aggregate(elem, adj_dict, s)
         return s
 
     def get_possible_moves(self):
@@ -91,14 +92,12 @@ class Env(gym.Env):
                     break
                 # check above
                 if y + 1 < self.height and self.board[x][y+1] == color:
-                    if (x, y) not in adj_dict:
-                        adj_dict[(x, y)] = list()
-                    adj_dict[(x,y)].append((x, y+1)) 
+                    adj_dict.setdefault((x, y), []).append((x, y+1))
+                    adj_dict.setdefault((x, y+1), []).append((x, y))
                 # check right
                 if x + 1 < self.width and self.board[x+1][y] == color:
-                    if (x, y) not in adj_dict:
-                        adj_dict[(x, y)] = list()
-                    adj_dict[(x,y)].append((x+1, y))
+                    adj_dict.setdefault((x, y), []).append((x+1, y))
+                    adj_dict.setdefault((x+1, y), []).append((x, y))
         moves = dict()
         covered = set()
         for key in adj_dict:
@@ -110,7 +109,7 @@ class Env(gym.Env):
 
     def make_move(self, action):
         assert action in self.possible_moves 
-        removed_tiles = [action] + self.possible_moves[action]
+        removed_tiles = self.possible_moves[action]
         for elem in removed_tiles:
             x, y = elem
             self.board[x][y] = "0"
@@ -135,7 +134,11 @@ class Env(gym.Env):
             if self._is_board_empty():
                 reward += 1000
             else:
-                reward -= 1000
+                # as the C++ env: (k - 2)^2 off for each color with k > 2 left
+                for color in range(1, self.num_colors):
+                    k = sum(col.count(str(color)) for col in self.board)
+                    if k > 2:
+                        reward -= (k - 2)**2
         self.possible_moves = self.get_possible_moves()
         self._total_reward += reward
         return self.board, reward, is_game_over, {}
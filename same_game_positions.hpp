@@ -0,0 +1,107 @@
+#pragma once
+#include <cctype>
+#include <cstdint>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Reads SameGame positions from a text file. A position is Height rows of
+// Width colors, top row first; colors are the digits 1..NumColors and may
+// be separated by spaces or commas, '0' or '.' marks an empty cell. Blank
+// lines separate positions and lines starting with '#' are comments, so a
+// whole test set can live in one file.
+template <class Env>
+std::vector<Env> load_same_game_positions(const std::string& path) {
+  std::ifstream in(path);
+  if (!in) {
+    throw std::runtime_error("cannot open " + path);
+  }
+
+  std::vector<Env> positions;
+  std::vector<std::string> rows;
+  int line_no = 0;
+
+  auto flush = [&]() {
+    if (rows.empty()) {
+      return;
+    }
+    if (rows.size() != Env::height) {
+      std::stringstream ss;
+      ss << path << ":" << line_no << ": position has " << rows.size()
+        << " rows, expected " << Env::height;
+      throw std::runtime_error(ss.str());
+    }
+    typename Env::board_type board{};
+    for (int row = 0; row < Env::height; row++) {
+      int y = Env::height - 1 - row;
+      for (int x = 0; x < Env::width; x++) {
+        board[x * Env::height + y] = rows[row][x];
+      }
+    }
+    positions.emplace_back(board);
+    rows.clear();
+  };
+
+  std::string line;
+  while (std::getline(in, line)) {
+    line_no++;
+    if (!line.empty() && line[0] == '#') {
+      continue;
+    }
+
+    std::string row;
+    for (char c : line) {
+      if (c >= '1' && c <= '0' + Env::num_colors) {
+        row.push_back(c - '0');
+      } else if (c == '0' || c == '.') {
+        row.push_back(0);
+      } else if (!std::isspace(static_cast<unsigned char>(c)) && c != ',') {
+        std::stringstream ss;
+        ss << path << ":" << line_no << ": unexpected '" << c << "'";
+        throw std::runtime_error(ss.str());
+      }
+    }
+
+    if (row.empty()) {
+      flush();
+      continue;
+    }
+    if (row.size() != Env::width) {
+      std::stringstream ss;
+      ss << path << ":" << line_no << ": row has " << row.size()
+        << " cells, expected " << Env::width;
+      throw std::runtime_error(ss.str());
+    }
+    rows.push_back(row);
+  }
+  flush();
+
+  return positions;
+}
+
+// Writes positions in the format read by load_same_game_positions.
+template <class Env>
+void write_same_game_position(std::ostream& out, const Env& env) {
+  for (int y = Env::height - 1; y >= 0; y--) {
+    for (int x = 0; x < Env::width; x++) {
+      out << static_cast<int>(env.get_tile(x, y));
+    }
+    out << std::endl;
+  }
+  out << std::endl;
+}
+
+// Random start position drawn from std::mt19937, whose output is fixed by
+// the standard, so the same seed gives the same board on every platform.
+template <class Env>
+Env random_same_game_position(std::uint32_t seed) {
+  std::mt19937 gen(seed);
+  typename Env::board_type board;
+  for (auto& tile : board) {
+    tile = (gen() % Env::num_colors) + 1;
+  }
+  return Env(board);
+}
@@ -1,34 +1,43 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstdio>
 #include <iostream> 
 #include <fstream>
+#include <iterator>
+#include <limits>
+#include <map>
 #include <queue> 
 #include <random>
 #include <set>
+#include <sstream>
 #include <stack>
+#include <thread>
+#include <string>
+#include <vector>
 
-static long int node_id = 0;
+static long int search_node_id = 0;
 
 template <class T>
-class node {
+class search_node {
   private:
     T env_;
     long int id_;
     long int parent_id_;
     std::vector<long int> seq_;
   public:
-    node(T env)
+    search_node(T env)
       : env_(env),
-        id_(node_id++),
+        id_(search_node_id++),
         parent_id_(-1),
         seq_({id_})
     {}
 
-    node(const node& other)
+    search_node(const search_node& other)
       : env_(other.env_),
-        id_(node_id++),
+        id_(search_node_id++),
         parent_id_(other.id_),
         seq_(other.seq_)
     {
@@ -88,99 +97,411 @@ auto first(T& ds) -> decltype(ds.top()) {
   return ds.top();
 }
 
-template <class T>
-std::pair<double, double> get_mean_and_var(T& container) {
-  double mean = 0;
-  int n = container.size();
+// Streaming mean and variance by Welford's update, so a statistic over
+// millions of rewards needs no list of them. The variance is the
+// population one, over n.
+class running_stats {
+  private:
+    std::size_t n_ = 0;
+    double mean_ = 0;
+    double m2_ = 0;
+  public:
+    running_stats() = default;
 
-  for (auto& elem : container) {
-    mean += elem;
-  } 
+    // an accumulator that has seen n values with these moments
+    running_stats(std::size_t n, double mean, double variance)
+      : n_(n), mean_(mean), m2_(variance * n)
+    {
+    }
 
-  mean /= n;
+    void add(double x) {
+      n_++;
+      double delta = x - mean_;
+      mean_ += delta / n_;
+      m2_ += delta * (x - mean_);
+    }
 
-  double var = 0;
-  for (auto& elem : container) {
-    var += (elem - mean) * (elem - mean);    
-  }
+    // Chan et al.'s pairwise combination, for accumulators filled apart.
+    void merge(const running_stats& other) {
+      if (other.n_ == 0) {
+        return;
+      }
+      std::size_t n = n_ + other.n_;
+      double delta = other.mean_ - mean_;
+      mean_ += delta * other.n_ / n;
+      m2_ += other.m2_ + delta * delta * n_ / n * other.n_;
+      n_ = n;
+    }
 
-  var /= n;
+    std::size_t count() const {
+      return n_;
+    }
 
-  return std::make_pair(mean, var);
-}
+    double mean() const {
+      return mean_;
+    }
 
-struct info {
-  std::vector<double> rewards;
-  int depth;
+    double variance() const {
+      return n_ ? m2_ / n_ : 0;
+    }
 };
 
+// What the analysis scripts fit, accumulated while the tree is sampled:
+// how many children the expanded nodes at each depth have, if any, the
+// depths where nodes had none, and the mean and variance of the rewards of the
+// nodes at each depth. The summary it writes replaces the raw tree_info
+// dump for nc.py and td.py; its size grows with the depth of the tree,
+// not the number of nodes.
+class tree_stats {
+  private:
+    // arity_[depth][arity] expanded nodes that had children; those without
+    // go to terminal_ only, so the branching data is what tree_info.py
+    // wrote to nc and the terminal depths what it wrote to td
+    std::vector<std::vector<std::size_t>> arity_;
+    std::vector<std::size_t> terminal_;
+    std::vector<running_stats> reward_;
+    std::size_t num_expanded_ = 0;
+
+    template <class V>
+    static void grow(V& v, std::size_t size) {
+      if (v.size() < size) {
+        v.resize(size);
+      }
+    }
+  public:
+    void add_expansion(int depth, std::size_t arity) {
+      if (arity == 0) {
+        grow(terminal_, depth + 1);
+        terminal_[depth]++;
+      } else {
+        grow(arity_, depth + 1);
+        grow(arity_[depth], arity + 1);
+        arity_[depth][arity]++;
+      }
+      num_expanded_++;
+    }
+
+    void add_reward(int depth, double reward) {
+      grow(reward_, depth + 1);
+      reward_[depth].add(reward);
+    }
+
+    void merge(const tree_stats& other) {
+      grow(arity_, other.arity_.size());
+      for (std::size_t d = 0; d < other.arity_.size(); d++) {
+        grow(arity_[d], other.arity_[d].size());
+        for (std::size_t a = 0; a < other.arity_[d].size(); a++) {
+          arity_[d][a] += other.arity_[d][a];
+        }
+      }
+      grow(terminal_, other.terminal_.size());
+      for (std::size_t d = 0; d < other.terminal_.size(); d++) {
+        terminal_[d] += other.terminal_[d];
+      }
+      grow(reward_, other.reward_.size());
+      for (std::size_t d = 0; d < other.reward_.size(); d++) {
+        reward_[d].merge(other.reward_[d]);
+      }
+      num_expanded_ += other.num_expanded_;
+    }
+
+    std::size_t get_num_expanded() const {
+      return num_expanded_;
+    }
+
+    const std::vector<std::vector<std::size_t>>& get_arity_counts() const {
+      return arity_;
+    }
+
+    const std::vector<std::size_t>& get_terminal_counts() const {
+      return terminal_;
+    }
+
+    const std::vector<running_stats>& get_reward_stats() const {
+      return reward_;
+    }
+
+    // One record per line, first word the kind, empty depths left out:
+    //   arity <depth> <arity>:<count> ...
+    //   terminal <depth> <count>
+    //   reward <depth> <count> <mean> <variance>
+    void write(std::ostream& out) const {
+      out << "expanded " << num_expanded_ << "\n";
+      for (std::size_t d = 0; d < arity_.size(); d++) {
+        bool any = false;
+        for (std::size_t a = 0; a < arity_[d].size(); a++) {
+          if (arity_[d][a]) {
+            out << (any ? " " : "arity " + std::to_string(d) + " ") << a << ":" << arity_[d][a];
+            any = true;
+          }
+        }
+        if (any) {
+          out << "\n";
+        }
+      }
+      for (std::size_t d = 0; d < terminal_.size(); d++) {
+        if (terminal_[d]) {
+          out << "terminal " << d << " " << terminal_[d] << "\n";
+        }
+      }
+      out.precision(17);
+      for (std::size_t d = 0; d < reward_.size(); d++) {
+        if (reward_[d].count()) {
+          out << "reward " << d << " " << reward_[d].count() << " "
+            << reward_[d].mean() << " " << reward_[d].variance() << "\n";
+        }
+      }
+    }
+
+    // Reads back what write() wrote, skipping lines it does not know.
+    static tree_stats read(std::istream& in) {
+      tree_stats stats;
+      std::string line;
+      while (std::getline(in, line)) {
+        std::stringstream ss(line);
+        std::string kind;
+        std::size_t depth;
+        ss >> kind;
+        if (kind == "expanded") {
+          ss >> stats.num_expanded_;
+          continue;
+        }
+        if (!(ss >> depth)) {
+          continue;
+        }
+        if (kind == "arity") {
+          grow(stats.arity_, depth + 1);
+          std::size_t arity;
+          char colon;
+          std::size_t count;
+          while (ss >> arity >> colon >> count) {
+            // older summaries also listed terminals as arity 0
+            if (arity == 0) {
+              continue;
+            }
+            grow(stats.arity_[depth], arity + 1);
+            stats.arity_[depth][arity] += count;
+          }
+        } else if (kind == "terminal") {
+          std::size_t count = 0;
+          ss >> count;
+          grow(stats.terminal_, depth + 1);
+          stats.terminal_[depth] += count;
+        } else if (kind == "reward") {
+          std::size_t count = 0;
+          double mean = 0;
+          double variance = 0;
+          ss >> count >> mean >> variance;
+          grow(stats.reward_, depth + 1);
+          stats.reward_[depth].merge(running_stats(count, mean, variance));
+        }
+      }
+      return stats;
+    }
+};
+
+// Samples num_rounds trees of up to max_iters nodes each, expanding in the
+// order of Container (a queue for breadth first, a stack for depth first)
+// with the children of each node shuffled. The statistics go to the
+// tree_stats file and are returned. With raw_tree_info the per-node child
+// rewards are also written to tree_info, for gr.py, which fits a model
+// per sibling group.
 template <class T, template <class...> class Container>
-void search(T& env, int num_rounds, std::size_t max_iters) {
+tree_stats search(T& env, int num_rounds, std::size_t max_iters, bool raw_tree_info = false) {
   std::random_device rd;
   std::mt19937 twister(rd());
-  
+
   std::string ti("tree_info");
   std::remove(ti.c_str());
+  std::ofstream ti_f;
+  if (raw_tree_info) {
+    ti_f.open(ti);
+  }
 
-  std::vector<info> infos;
+  tree_stats stats;
+  std::vector<double> child_rewards;
 
   for (int i = 0; i < num_rounds; i++) {
     std::cout << "round (" << i << "/" << num_rounds << ")" << std::endl;
-    Container<node<T>> s;
-    node<T> root(env);
+    Container<search_node<T>> s;
+    search_node<T> root(env);
     s.push(root);
     std::size_t iters = 0;
 
     while (!s.empty() && iters < max_iters) {
-      node<T> v = first(s);
+      search_node<T> v = first(s);
       s.pop();
 
       auto moves = v.get_possible_moves();
       std::shuffle(moves.begin(), moves.end(), twister);
-      
-      std::size_t num_moves = moves.size();
-      
-      info inf;
 
-      std::vector<double> child_rewards;
-      inf.depth = v.get_depth();
+      int depth = v.get_depth();
+      stats.add_expansion(depth, moves.size());
+      child_rewards.clear();
 
       for (auto& move : moves) {
-        node<T> child(v);
+        search_node<T> child(v);
         child.step(move);
         s.push(child);
-        child_rewards.push_back(child.get_curr_reward());
+        double reward = child.get_curr_reward();
+        stats.add_reward(child.get_depth(), reward);
+        child_rewards.push_back(reward);
         iters++;
       }
 
-      inf.rewards = child_rewards;
-      infos.push_back(inf);
-    }    
-  }
-
-  std::ofstream ti_f(ti);
-  for (auto& inf : infos) {
-    auto it = inf.rewards.begin();
-    if (it != inf.rewards.end()) {
-      ti_f << *it;
-    }
-    while (it != inf.rewards.end()) {
-      ti_f << "," << *it;
-      it++;
+      if (raw_tree_info) {
+        auto it = child_rewards.begin();
+        if (it != child_rewards.end()) {
+          ti_f << *it++;
+        }
+        while (it != child_rewards.end()) {
+          ti_f << "," << *it++;
+        }
+        ti_f << ";" << depth << "\n";
+      }
     }
-    ti_f << ";";
-    ti_f << inf.depth << std::endl;
   }
-  ti_f.close();
+
+  std::ofstream stats_f("tree_stats");
+  stats.write(stats_f);
+  return stats;
 }
 
 template <class T>
-void bfs(T& env, int num_rounds = 1, std::size_t max_iters = 1e6) {
-  search<T, std::queue>(env, num_rounds, max_iters);
+tree_stats bfs(T& env, int num_rounds = 1, std::size_t max_iters = 1e6) {
+  return search<T, std::queue>(env, num_rounds, max_iters);
 }
 
 template <class T>
-void dfs(T& env, int num_rounds = 1, std::size_t max_iters = 1e6) {
-  search<T, std::stack>(env, num_rounds, max_iters);
+tree_stats dfs(T& env, int num_rounds = 1, std::size_t max_iters = 1e6) {
+  return search<T, std::stack>(env, num_rounds, max_iters);
+}
+
+// Best state found by best_first or beam_search: the moves that reach it,
+// its total reward and how many states were expanded on the way.
+template <class T>
+struct search_result {
+  std::vector<typename T::move_type> seq;
+  double reward = -std::numeric_limits<double>::infinity();
+  std::size_t num_expanded = 0;
+
+  void offer(const T& env) {
+    if (env.get_total_reward() > reward) {
+      reward = env.get_total_reward();
+      seq = env.get_seq();
+    }
+  }
+};
+
+// Greedy best-first search on the total reward so far. The frontier is
+// ordered by that reward and holds at most max_frontier states; when it
+// is full the worst one is dropped, so memory stays bounded however long
+// the search runs. Stops when the frontier empties, after max_expansions
+// states or once seconds have passed.
+template <class T>
+search_result<T> best_first(const T& env, std::size_t max_frontier,
+    std::size_t max_expansions = std::numeric_limits<std::size_t>::max(),
+    double seconds = std::numeric_limits<double>::infinity()) {
+  using clock = std::chrono::steady_clock;
+  auto start = clock::now();
+
+  search_result<T> result;
+  result.offer(env);
+  std::multimap<double, T> frontier;
+  frontier.emplace(env.get_total_reward(), env);
+
+  while (!frontier.empty() && result.num_expanded < max_expansions) {
+    if (result.num_expanded % 256 == 0 &&
+        std::chrono::duration<double>(clock::now() - start).count() > seconds) {
+      break;
+    }
+    auto best = std::prev(frontier.end());
+    T v = std::move(best->second);
+    frontier.erase(best);
+    result.num_expanded++;
+
+    for (auto& move : v.get_possible_moves()) {
+      T child(v);
+      child.step(move);
+      result.offer(child);
+      if (child.is_game_over()) {
+        continue;
+      }
+      double priority = child.get_total_reward();
+      if (frontier.size() >= max_frontier) {
+        if (priority <= frontier.begin()->first) {
+          continue;
+        }
+        frontier.erase(frontier.begin());
+      }
+      frontier.emplace(priority, std::move(child));
+    }
+  }
+  return result;
 }
 
+// Beam search of width W on the total reward so far. Each depth's beam is
+// expanded by num_threads threads taking states from a shared counter,
+// and the children are cut back to the best W by a partial selection
+// rather than a full sort. Stops when no state is left to expand or once
+// seconds have passed.
+template <class T>
+search_result<T> beam_search(const T& env, std::size_t width,
+    unsigned num_threads = std::thread::hardware_concurrency(),
+    double seconds = std::numeric_limits<double>::infinity()) {
+  using clock = std::chrono::steady_clock;
+  auto deadline = clock::now() + std::chrono::duration_cast<clock::duration>(
+      std::chrono::duration<double>(std::min(seconds, 1e9)));
+  num_threads = std::max(1u, num_threads);
+
+  search_result<T> result;
+  result.offer(env);
+  std::vector<T> beam{env};
+  std::vector<std::vector<T>> children(num_threads);
+  std::vector<search_result<T>> bests(num_threads);
+
+  while (!beam.empty() && clock::now() < deadline) {
+    std::atomic<std::size_t> next(0);
+    auto work = [&](unsigned t) {
+      children[t].clear();
+      for (std::size_t i = next++; i < beam.size(); i = next++) {
+        for (auto& move : beam[i].get_possible_moves()) {
+          T child(beam[i]);
+          child.step(move);
+          bests[t].offer(child);
+          if (!child.is_game_over()) {
+            children[t].push_back(std::move(child));
+          }
+        }
+      }
+    };
+    std::vector<std::thread> workers;
+    for (unsigned t = 1; t < num_threads && t < beam.size(); t++) {
+      workers.emplace_back(work, t);
+    }
+    work(0);
+    for (auto& worker : workers) {
+      worker.join();
+    }
+    result.num_expanded += beam.size();
+
+    beam.clear();
+    for (auto& part : children) {
+      std::move(part.begin(), part.end(), std::back_inserter(beam));
+      part.clear();
+    }
+    if (beam.size() > width) {
+      std::nth_element(beam.begin(), beam.begin() + width, beam.end(),
+          [](const T& a, const T& b) { return a.get_total_reward() > b.get_total_reward(); });
+      beam.erase(beam.begin() + width, beam.end());
+    }
+  }
+
+  for (auto& best : bests) {
+    if (best.reward > result.reward) {
+      result.reward = best.reward;
+      result.seq = best.seq;
+    }
+  }
+  return result;
+}
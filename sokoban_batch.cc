@@ -0,0 +1,253 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ida_star.hpp"
+#include "mcts.hpp"
+#include "search.hpp"
+#include "sokoban_env.hpp"
+#include "sokoban_pack.hpp"
+
+// Runs an engine on every level of one or more packs under a per-level
+// time budget and writes one CSV row per level. Levels are handed out one
+// at a time from a shared counter, so a thread that finishes early takes
+// the next level instead of idling behind a slow one. A level that fails
+// to load or throws is reported and skipped. threads are level threads:
+// every engine searches a level on one thread, ida included, since
+// ida_star's own threads do not scale yet.
+//
+//   sokoban_batch <pack or directory> [seconds=10] [threads=all] [engine=mcts-push] [csv=-]
+
+namespace fs = std::filesystem;
+using level_ptr = std::shared_ptr<const sokoban_level>;
+
+struct engine_result {
+  // the solution as single steps, walks included
+  std::vector<sokoban_env::direction> solution;
+  std::size_t nodes;
+  std::size_t iterations;
+};
+
+using engine_type = std::function<engine_result(const level_ptr&, double, unsigned)>;
+
+template <class Env>
+engine_result run_mcts(const level_ptr& level, double seconds, unsigned seed) {
+  Env env(level);
+  MCTS<Env> mcts(env, seed);
+  for (auto& move : mcts.search_for(seconds)) {
+    env.step(move);
+  }
+  return engine_result{env.get_solution(), mcts.get_num_nodes(), mcts.get_num_iterations()};
+}
+
+// One search thread per level; the batch already runs levels in parallel.
+engine_result run_ida(const level_ptr& level, double seconds, unsigned) {
+  sokoban_push_env env(level);
+  ida_star<sokoban_push_env> ida(env, 1);
+  for (auto& move : ida.search_for(seconds)) {
+    env.step(move);
+  }
+  return engine_result{env.get_solution(), ida.get_num_nodes(), ida.get_num_iterations()};
+}
+
+// Baselines on push moves; iterations are expanded states.
+engine_result run_best_first(const level_ptr& level, double seconds, unsigned) {
+  sokoban_push_env env(level);
+  auto res = best_first(env, 100000, std::numeric_limits<std::size_t>::max(), seconds);
+  for (auto& move : res.seq) {
+    env.step(move);
+  }
+  return engine_result{env.get_solution(), res.num_expanded, res.num_expanded};
+}
+
+engine_result run_beam(const level_ptr& level, double seconds, unsigned) {
+  sokoban_push_env env(level);
+  auto res = beam_search(env, 1000, 1, seconds);
+  for (auto& move : res.seq) {
+    env.step(move);
+  }
+  return engine_result{env.get_solution(), res.num_expanded, res.num_expanded};
+}
+
+static const std::map<std::string, engine_type> engines = {
+  {"mcts", run_mcts<sokoban_env>},
+  {"mcts-push", run_mcts<sokoban_push_env>},
+  {"ida", run_ida},
+  {"best-first", run_best_first},
+  {"beam", run_beam},
+};
+
+struct level_job {
+  std::string pack;
+  std::string name;
+  level_ptr level;
+  std::string error;
+};
+
+struct level_result {
+  std::string status;
+  std::size_t length = 0;
+  std::size_t pushes = 0;
+  std::size_t nodes = 0;
+  std::size_t iterations = 0;
+  double seconds = 0;
+  double reward_cache_hit_rate = 0;
+};
+
+static std::vector<level_job> load_jobs(const std::string& path) {
+  std::vector<fs::path> files;
+  if (fs::is_directory(path)) {
+    for (auto& entry : fs::directory_iterator(path)) {
+      std::string ext = entry.path().extension().string();
+      if (entry.is_regular_file() && (ext == ".xsb" || ext == ".sok" || ext == ".cfg" || ext == ".txt")) {
+        files.push_back(entry.path());
+      }
+    }
+    std::sort(files.begin(), files.end());
+  } else {
+    files.push_back(path);
+  }
+
+  std::vector<level_job> jobs;
+  for (auto& file : files) {
+    for (auto& entry : load_sokoban_pack(file.string())) {
+      jobs.push_back(level_job{file.filename().string(), entry.name, entry.level, entry.error});
+    }
+  }
+  return jobs;
+}
+
+// Replays the steps on a fresh env, so an engine cannot claim a solve it
+// did not play. Each step must follow the rules of the game: walk into a
+// free cell, or push a box into a free cell, marked as a push. The search's
+// move list is no test, since it leaves out pushes into deadlocks that a
+// solution may still legally make. The first step that breaks the rules
+// makes the whole solution illegal.
+static level_result check_solution(const level_ptr& level, const engine_result& res) {
+  level_result out;
+  out.length = res.solution.size();
+  out.nodes = res.nodes;
+  out.iterations = res.iterations;
+  sokoban_env env(level);
+  for (auto dir : res.solution) {
+    bool is_push = dir >= sokoban_env::UP;
+    if (dir < sokoban_env::up || dir > sokoban_env::LEFT || !env.is_valid_direction(dir) ||
+        env.is_block_push(dir) != is_push) {
+      out.status = "illegal";
+      return out;
+    }
+    if (is_push) {
+      out.pushes++;
+    }
+    env.step(dir);
+  }
+  bool solved = env.get_num_correct_boxes() == level->start_boxes.count();
+  out.status = solved ? "solved" : "unsolved";
+  return out;
+}
+
+static std::string csv_field(const std::string& s) {
+  if (s.find_first_of(",\"\n") == std::string::npos) {
+    return s;
+  }
+  std::string quoted = "\"";
+  for (char c : s) {
+    quoted += c == '"' ? "\"\"" : std::string(1, c);
+  }
+  return quoted + "\"";
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    std::cerr << "usage: " << argv[0] << " <pack or directory> [seconds] [threads] [engine] [csv]" << std::endl
+      << "threads run levels in parallel; each level is searched on one thread, ida included" << std::endl;
+    return 1;
+  }
+
+  double seconds = argc > 2 ? std::stod(argv[2]) : 10;
+  unsigned num_threads = argc > 3 ? std::stoul(argv[3]) : std::thread::hardware_concurrency();
+  std::string engine_name = argc > 4 ? argv[4] : "mcts-push";
+  std::string csv_path = argc > 5 ? argv[5] : "-";
+  num_threads = std::max(1u, num_threads);
+
+  auto engine_it = engines.find(engine_name);
+  if (engine_it == engines.end()) {
+    std::cerr << "unknown engine " << engine_name << ", choose one of:";
+    for (auto& engine : engines) {
+      std::cerr << " " << engine.first;
+    }
+    std::cerr << std::endl;
+    return 1;
+  }
+  const engine_type& engine = engine_it->second;
+
+  std::vector<level_job> jobs;
+  try {
+    jobs = load_jobs(argv[1]);
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  std::ofstream csv_file;
+  if (csv_path != "-") {
+    csv_file.open(csv_path);
+    if (!csv_file) {
+      std::cerr << "cannot write " << csv_path << std::endl;
+      return 1;
+    }
+  }
+  std::ostream& csv = csv_path == "-" ? std::cout : csv_file;
+
+  std::vector<level_result> results(jobs.size());
+  std::atomic<std::size_t> next(0);
+  std::atomic<std::size_t> num_solved(0);
+  std::vector<std::thread> workers;
+  for (unsigned t = 0; t < num_threads; t++) {
+    workers.emplace_back([&]() {
+      for (std::size_t i = next++; i < jobs.size(); i = next++) {
+        const level_job& job = jobs[i];
+        level_result& res = results[i];
+        if (!job.level) {
+          res.status = "error: " + job.error;
+          continue;
+        }
+        auto start = std::chrono::steady_clock::now();
+        try {
+          res = check_solution(job.level, engine(job.level, seconds, i + 1));
+        } catch (const std::exception& e) {
+          res.status = std::string("error: ") + e.what();
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        res.seconds = elapsed.count();
+        res.reward_cache_hit_rate = job.level->reward_cache.hit_rate();
+        num_solved += res.status == "solved";
+        std::cerr << "." << std::flush;
+      }
+    });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  std::cerr << std::endl;
+
+  csv << "pack,level,status,length,pushes,nodes,iterations,iterations_per_sec,seconds,reward_cache_hit_rate" << std::endl;
+  for (std::size_t i = 0; i < jobs.size(); i++) {
+    const level_result& res = results[i];
+    csv << csv_field(jobs[i].pack) << "," << csv_field(jobs[i].name) << ","
+      << csv_field(res.status) << "," << res.length << "," << res.pushes << ","
+      << res.nodes << "," << res.iterations << ","
+      << (res.seconds > 0 ? res.iterations / res.seconds : 0) << "," << res.seconds << ","
+      << res.reward_cache_hit_rate << std::endl;
+  }
+  std::cerr << engine_name << ": solved " << num_solved << " of " << jobs.size() << " levels, "
+    << seconds << "s per level, " << num_threads << " threads" << std::endl;
+}
@@ -1,86 +1,196 @@
 #pragma once
-#include <deque>
-#include <fstream>
+#include <algorithm>
 #include <iostream>
-#include <limits>
-#include <map>
-#include <set>
-#include <sstream>
-#include <string> 
+#include <memory>
+#include <string>
+#include <type_traits>
 #include <utility>
 #include <vector>
+#include "assignment.hpp"
+#include "sokoban_level.hpp"
+
+// Types shared by both action spaces.
+struct sokoban_types {
+  enum direction { null, up, right, down, left, UP, RIGHT, DOWN, LEFT };
+  // cell index into the level's padded grid
+  using position_type = short;
+  using level_type = sokoban_level;
+  // push-level action: the cell of the box before the push and the push
+  // direction (UP, RIGHT, DOWN or LEFT)
+  using push_type = std::pair<position_type, direction>;
+};
 
-class sokoban_env {
-  public:
-    enum direction { null, up, right, down, left, UP, RIGHT, DOWN, LEFT }; 
-    using board_type = std::vector<std::vector<char>>;
-    using position_type = std::pair<short, short>;
-    using move_type = direction;
-    using dist_table = std::map<std::pair<position_type, position_type>, int>;
-  private: 
-    board_type board_;
-    position_type human_pos_;
-    std::vector<position_type> box_positions_;
-    std::vector<position_type> goal_positions_;
-    int num_moves_ = 0;
-    std::vector<move_type> seq_;
-    bool is_game_over_ = false;
-    static dist_table dist_;
-    static std::set<position_type> reachable_positions_; 
+// A Sokoban state is the set of boxes, as a bitset over the level's
+// interior cells, plus the player's cell; walls, goals and distance tables
+// live in the shared sokoban_level. The move history is a persistent list
+// shared with the parent state, so copying an env costs a few words and
+// two reference counts.
+//
+// With PushMoves set, an action is a whole push: any box the player can
+// walk up to, in any direction it can be pushed. The walks are not played
+// out; the player just lands on the box's old cell, and get_solution
+// expands them into single steps when the solution is emitted. States are
+// then hashed by their player region, so pushes reached through different
+// walks merge.
+template <bool PushMoves>
+class basic_sokoban_env : public sokoban_types {
   public:
-    sokoban_env(std::string board_file_str) {
-      std::ifstream board_file(board_file_str);
-      std::string line;
+    static constexpr bool push_moves = PushMoves;
+    using move_type = std::conditional_t<PushMoves, push_type, direction>;
+  private:
+    struct seq_node {
+      move_type move;
+      std::shared_ptr<const seq_node> prev;
+    };
 
-      board_type tmp;
+    std::shared_ptr<const level_type> level_;
+    cell_set boxes_;
+    position_type player_;
+    short num_moves_ = 0;
+    // games end after this many actions, which bounds rollouts; no_move_cap
+    // turns that off
+    short max_moves_ = 40;
+    bool is_game_over_ = false;
+    // set by a push onto a dead square or into a freeze or pattern deadlock
+    bool is_deadlocked_ = false;
+    // push mode keeps the player region from its last flood fill
+    short region_ = -1;
+    std::shared_ptr<const seq_node> seq_;
+
+    static constexpr const direction dirs[] = {
+      direction::up, direction::right, direction::down, direction::left
+    };
 
-      while (std::getline(board_file, line)) {
-        board_.push_back(std::vector<char>(line.begin(), line.end()));
+    int offset(direction dir) const {
+      if (dir == direction::up || dir == direction::UP) {
+        return -level_->cols;
+      } else if (dir == direction::right || dir == direction::RIGHT) {
+        return 1;
+      } else if (dir == direction::down || dir == direction::DOWN) {
+        return level_->cols;
+      } else {
+        return -1;
       }
+    }
+
+    bool is_box(int cell) const {
+      int i = level_->interior[cell];
+      return i >= 0 && boxes_.test(i);
+    }
+
+    // floor or goal without a box
+    bool is_open(int cell) const {
+      return !level_->wall[cell] && !is_box(cell);
+    }
 
-      for (short i = 0; i < board_.size(); i++) {
-        for (short j = 0; j < board_[i].size(); j++) {
-          char tile = board_[i][j];
-          if (tile == '@') {
-            human_pos_ = std::make_pair(i, j);
-          } else if (tile == '$') {
-            box_positions_.push_back(std::make_pair(i, j));
-          } else if (tile == '.') {
-            goal_positions_.push_back(std::make_pair(i, j));
+    // floor or goal with neither a box nor the player on it
+    bool is_goal_or_free(int cell) const {
+      return is_open(cell) && cell != player_;
+    }
+
+    // Marks the cells the player can walk to without pushing, and returns
+    // the lowest interior index among them. The buffer is per thread.
+    const std::vector<char>& player_reach(int& region) const {
+      static thread_local std::vector<char> seen;
+      static thread_local std::vector<short> stack;
+      seen.assign(level_->num_cells(), 0);
+      stack.clear();
+      stack.push_back(player_);
+      seen[player_] = 1;
+      region = level_->interior[player_];
+      while (!stack.empty()) {
+        int cell = stack.back();
+        stack.pop_back();
+        region = std::min<int>(region, level_->interior[cell]);
+        for (direction dir : dirs) {
+          int next = cell + offset(dir);
+          if (!seen[next] && is_open(next)) {
+            seen[next] = 1;
+            stack.push_back(next);
           }
         }
       }
+      return seen;
+    }
 
-      if (reachable_positions_.empty()) {
-        get_reachable();
-      }
+    // O(1) dead-square lookup first; the freeze test only visits the boxes
+    // around dest.
+    bool can_push_to(int src, int dest) const {
+      return is_open(dest) && level_->live[dest] && !will_deadlock(src, dest);
     }
 
-    sokoban_env(const sokoban_env& other) 
-      : board_(other.board_), 
-        human_pos_(other.human_pos_),
-        box_positions_(other.box_positions_),
-        goal_positions_(other.goal_positions_),
-        num_moves_(other.num_moves_),
-        seq_(other.seq_),
-        is_game_over_(other.is_game_over_)
+    bool will_deadlock(int src, int dest) const {
+      cell_set boxes = boxes_;
+      boxes.reset(level_->interior[src]);
+      boxes.set(level_->interior[dest]);
+      return level_->is_freeze_deadlock(boxes, dest) || level_->is_pattern_deadlock(boxes, dest);
+    }
+
+    // Whether the player can reach and make any push, caching the player
+    // region on the way. With push actions a state without a push is
+    // terminal; when stepping, walking always remains.
+    bool has_push() {
+      int region;
+      const std::vector<char>& reach = player_reach(region);
+      region_ = region;
+      bool found = false;
+      boxes_.for_each([&](int i) {
+        int box = level_->cells[i];
+        for (direction dir : dirs) {
+          found = found || (reach[box - offset(dir)] && can_push_to(box, box + offset(dir)));
+        }
+      });
+      return found;
+    }
+  public:
+    basic_sokoban_env(std::string board_file_str)
+      : basic_sokoban_env(level_type::from_file(board_file_str))
+    {
+    }
+
+    explicit basic_sokoban_env(std::shared_ptr<const level_type> level)
+      : level_(std::move(level)),
+        boxes_(level_->start_boxes),
+        player_(level_->start_player),
+        is_deadlocked_(is_any_box_stuck())
     {
+      if constexpr (PushMoves) {
+        is_game_over_ = is_game_over() || !has_push();
+      }
+    }
+
+    const level_type& get_level() const {
+      return *level_;
     }
 
     int get_num_steps() const {
       return num_moves_;
     }
 
+    // Exact state (boxes and player cell) when stepping, since walking
+    // moves must not be merged away; the canonical state with pushes.
     std::size_t hash() const {
-      std::stringstream ss;
-      for (int i = 0; i < board_.size(); i++) {
-        for (int j = 0; j < board_[i].size(); j++) {
-          ss << board_[i][j];
-        }
+      if constexpr (PushMoves) {
+        return canonical_hash();
+      } else {
+        return boxes_.hash() ^ (std::size_t(player_) * 0x9e3779b97f4a7c15ULL);
       }
+    }
 
-      std::size_t h = std::hash<std::string>{}(ss.str());
-      return h;
+    // Boxes and the player's reachable region, identified by its lowest
+    // interior index, so states that differ only by where the player stands
+    // inside one region hash alike.
+    std::size_t canonical_hash() const {
+      return boxes_.hash() ^ (std::size_t(player_region()) * 0x9e3779b97f4a7c15ULL);
+    }
+
+    int player_region() const {
+      if (region_ != -1) {
+        return region_;
+      }
+      int region;
+      player_reach(region);
+      return region;
     }
 
     static std::string get_dir_str(direction dir) {
@@ -102,49 +212,29 @@ class sokoban_env {
         return "DOWN";
       } else {
         return "LEFT";
-      } 
-    } 
-
-    int get_total_reward() const {
-      return get_reward();
-    }
-
-    position_type get_shifted_position(position_type pos, direction dir) const {
-      if (dir == direction::up || dir == direction::UP) {
-        return std::make_pair(pos.first - 1, pos.second);
-      } else if (dir == direction::right || dir == direction::RIGHT) {
-        return std::make_pair(pos.first, pos.second + 1);
-      } else if (dir == direction::down || dir == direction::DOWN) {
-        return std::make_pair(pos.first + 1, pos.second);
-      } else {
-        return std::make_pair(pos.first, pos.second - 1);
       }
     }
 
-    bool is_goal_or_free(char tile) const {
-      return tile == ' ' || tile == '.';
+    int get_total_reward() const {
+      return get_reward();
     }
 
     bool is_valid_direction(direction dir) const {
-      position_type pos = get_shifted_position(human_pos_, dir);
-      char tile = board_[pos.first][pos.second];
+      int pos = player_ + offset(dir);
 
-      if (is_goal_or_free(tile)) {
+      if (is_goal_or_free(pos)) {
         return true;
       }
 
-      if (tile == '$') {
-        position_type shifted = get_shifted_position(pos, dir);
-        char shifted_tile = board_[shifted.first][shifted.second];
-        return is_goal_or_free(shifted_tile);
+      if (is_box(pos)) {
+        return is_goal_or_free(pos + offset(dir));
       }
 
       return false;
     }
 
     bool is_block_push(direction dir) const {
-      position_type pos = get_shifted_position(human_pos_, dir);
-      return board_[pos.first][pos.second] == '$';
+      return is_box(player_ + offset(dir));
     }
 
     direction uppercase(direction dir) const {
@@ -159,152 +249,46 @@ class sokoban_env {
       }
     }
 
-    bool is_in_bounds(position_type pos) const {
-      return pos.first >= 0 && pos.first < board_.size()
-        && pos.second >= 0 && pos.second < board_[0].size();
-    }
-
-    bool is_not_wall(position_type pos) const {
-      return board_[pos.first][pos.second] != '#';
-    }
-
-    void bfs_explore(position_type pos, std::set<position_type>& visited) const {
-      if (visited.count(pos)) {
-        return;
-      }
-
-      visited.insert(pos);
-
-      std::vector<direction> dirs = { 
-        direction::up, direction::right, 
-        direction::down, direction::left 
-      };
-
-      for (auto& dir : dirs) {
-        auto one_step = get_shifted_position(pos, dir);
-        auto two_step = get_shifted_position(one_step, dir);
-        if (is_in_bounds(one_step) && is_in_bounds(two_step) &&
-            is_not_wall(one_step) && is_not_wall(two_step)) {
-          bfs_explore(one_step, visited);
-        }
-      }
-    }
-
-    void get_reachable() {
-      for (auto it = goal_positions_.begin(); it != goal_positions_.end(); ++it) {
-        auto goal_pos = *it;
-        std::set<position_type> visited;
-        bfs_explore(goal_pos, visited);
-        reachable_positions_.insert(visited.begin(), visited.end());
-      }
-      for (auto& pos : reachable_positions_) {
-        std::cout << pair_to_str(pos) << std::endl;
-      }
-    }
-
-
-    bool would_not_lock(position_type considered, position_type hypothetical) const {
-      auto up = get_shifted_position(considered, direction::up);
-      auto right = get_shifted_position(considered, direction::right);
-      auto down = get_shifted_position(considered, direction::down);
-      auto left = get_shifted_position(considered, direction::left);
-
-      bool up_clear = is_in_bounds(up) && up != hypothetical && is_goal_or_free(board_[up.first][up.second]);
-      bool right_clear = is_in_bounds(right) && right  != hypothetical && is_goal_or_free(board_[right.first][right.second]);
-      bool down_clear = is_in_bounds(down) && down != hypothetical && is_goal_or_free(board_[down.first][down.second]);
-      bool left_clear = is_in_bounds(left) && left != hypothetical && is_goal_or_free(board_[left.first][left.second]);
-
-      return ((up_clear && down_clear) || (left_clear && right_clear));
-    }
-
-    bool will_freeze_deadlock(position_type src, position_type dest) {
-      if (board_[dest.first][dest.second] == '.') {
-        return false;
-      }
-
-      auto up = get_shifted_position(dest, direction::up);
-      auto right = get_shifted_position(dest, direction::right);
-      auto down = get_shifted_position(dest, direction::down);
-      auto left = get_shifted_position(dest, direction::left);
-
-      bool up_clear = up == src || is_goal_or_free(board_[up.first][up.second]) || would_not_lock(up, dest);
-      bool right_clear = right == src || is_goal_or_free(board_[right.first][right.second]) || would_not_lock(right, dest);
-      bool down_clear = down == src || is_goal_or_free(board_[down.first][down.second]) || would_not_lock(down, dest);
-      bool left_clear = left == src || is_goal_or_free(board_[left.first][left.second]) || would_not_lock(left, dest);
-
-      return !((up_clear && down_clear) || (left_clear && right_clear));
-    }
-
-
-    std::vector<direction> get_possible_moves() {
+    std::vector<move_type> get_possible_moves() const {
       if (is_game_over_) {
         return {};
       }
 
-      std::vector<direction> moves;
-
-      std::vector<direction> dirs = {
-        direction::up,
-        direction::right,
-        direction::down,
-        direction::left
-      };
-
-      for (auto dir : dirs) {
-        if (is_valid_direction(dir)) {
-          if (is_block_push(dir)) {
-            auto one_step = get_shifted_position(human_pos_, dir);
-            auto two_step = get_shifted_position(one_step, dir);
+      std::vector<move_type> moves;
 
-            if (reachable_positions_.count(two_step) && 
-                !will_freeze_deadlock(one_step, two_step)) {
-              moves.push_back(uppercase(dir));
+      if constexpr (PushMoves) {
+        int region;
+        const std::vector<char>& reach = player_reach(region);
+        boxes_.for_each([&](int i) {
+          int box = level_->cells[i];
+          for (direction dir : dirs) {
+            if (reach[box - offset(dir)] && can_push_to(box, box + offset(dir))) {
+              moves.push_back(push_type(box, uppercase(dir)));
             }
-          } else {
-            moves.push_back(dir);
           }
-        } 
-      }
-
-      return moves;
-    }
-
-    bool is_box_stuck(position_type pos) const {
-      if (std::find(goal_positions_.begin(), goal_positions_.end(), pos) != goal_positions_.end()) {
-        return false;
-      }
-
-      std::vector<position_type> sides = {
-        get_shifted_position(pos, direction::left),
-        get_shifted_position(pos, direction::up),
-        get_shifted_position(pos, direction::right),
-        get_shifted_position(pos, direction::down),
-        get_shifted_position(pos, direction::left)
-      }; 
-
-      bool prev_blocked = false;
-      for (auto it = sides.begin(); it != sides.end(); ++it) {
-        char tile = board_[it->first][it->second];
-        if (tile == '#') {
-          if (prev_blocked) {
-            return true;
-          } else {
-            prev_blocked = true;
+        });
+      } else {
+        for (direction dir : dirs) {
+          if (is_valid_direction(dir)) {
+            if (is_block_push(dir)) {
+              int one_step = player_ + offset(dir);
+              if (can_push_to(one_step, one_step + offset(dir))) {
+                moves.push_back(uppercase(dir));
+              }
+            } else {
+              moves.push_back(dir);
+            }
           }
-        } else {
-          prev_blocked = false;
         }
       }
-      return false;
+
+      return moves;
     }
 
+    // Full scan over every box; step keeps is_deadlocked_ up to date
+    // incrementally, so this only runs on construction.
     bool is_any_box_stuck() const {
-      for (auto it = box_positions_.begin(); it != box_positions_.end(); ++it) {
-        if (is_box_stuck(*it)) {
-          return true;
-        }     
-      }
-      return false;
+      return level_->is_deadlock(boxes_);
     }
 
     double get_curr_reward() const {
@@ -316,204 +300,176 @@ class sokoban_env {
     }
 
     bool is_game_over() const {
-      return get_num_correct_boxes() == box_positions_.size() || 
-          is_any_box_stuck() || num_moves_ > 40;
+      return is_game_over_ || get_num_correct_boxes() == boxes_.count() ||
+          is_deadlocked_ || (max_moves_ != no_move_cap && num_moves_ > max_moves_);
     }
 
-    int get_num_correct_boxes() const {
-      int num_correct = 0;
-      for (auto it = box_positions_.begin(); it != box_positions_.end(); ++it) {
-        if (std::find(goal_positions_.begin(), goal_positions_.end(), *it) != 
-            goal_positions_.end()) {
-          num_correct++;
-        } 
-      }
-      return num_correct;
-    }
+    static constexpr int no_move_cap = -1;
 
-    std::vector<move_type> get_seq() const {
-      return seq_;
+    // Exact searches lift the cap with no_move_cap; copies inherit it.
+    void set_max_moves(int max_moves) {
+      max_moves_ = max_moves;
     }
 
-    void print_seq() const {
-      std::cout << "seq: ";
-      for (auto it = seq_.begin(); it != seq_.end(); ++it) {
-        std::cout << get_dir_str(*it) << " "; 
-      }
-      std::cout << std::endl;
+    bool is_solved() const {
+      return get_num_correct_boxes() == boxes_.count();
     }
 
-    std::string pair_to_str(position_type pos) {
-      std::stringstream ss;
-      ss << "(" << pos.first << "," << pos.second << ")";
-      return ss.str(); 
+    int get_num_correct_boxes() const {
+      return boxes_.count_common(level_->goal_set);
     }
 
-    struct MinElemQueue {
-      private:
-        std::map<position_type, int>& dm_;
-      public:
-        MinElemQueue(std::map<position_type, int>& dist) 
-          : dm_(dist) 
-        {}
-
-        bool operator()(const position_type& l, const position_type& r) const { 
-          return dm_[l] < dm_[r]; 
-        }
-    };
-
-
-    int shortest_distance_path(position_type src, position_type dest) const {
-      std::pair<position_type, position_type> src_dest_pair(src, dest);
-      if (dist_.count(src_dest_pair)) {
-        return dist_[src_dest_pair];
-      }
-
-      std::map<position_type, int> dist;
-      std::deque<position_type> Q;
-
-      for (int y = 0; y < board_.size(); y++) {
-        for (int x = 0; x < board_[0].size(); x++) {
-          position_type tmp(y, x);
-          dist[tmp] = 9999;
-          Q.push_back(tmp);
-        }
+    std::vector<move_type> get_seq() const {
+      std::vector<move_type> seq(num_moves_);
+      const seq_node* node = seq_.get();
+      for (int i = num_moves_ - 1; i >= 0; i--) {
+        seq[i] = node->move;
+        node = node->prev.get();
       }
+      return seq;
+    }
 
-      dist[src] = 0;
-
-      MinElemQueue meq(dist);
-      while (!Q.empty()) {
-        auto min_elem_it = std::min_element(Q.begin(), Q.end(), meq);
-        position_type u = *min_elem_it;
-
-        std::vector<position_type> neighbors = {
-          get_shifted_position(u, direction::up),
-          get_shifted_position(u, direction::right),
-          get_shifted_position(u, direction::down),
-          get_shifted_position(u, direction::left)
-        };
-
-        for (auto& v : neighbors) {
-          if (is_in_bounds(v)) {
-            int cost = is_not_wall(v) ? 1 : 9999;
-            dist[v] = std::min(dist[v], dist[u] + cost);
+    // The solution as single steps, walks included.
+    std::vector<direction> get_solution() const {
+      if constexpr (!PushMoves) {
+        return get_seq();
+      } else {
+        std::vector<direction> solution;
+        std::vector<short> from(level_->num_cells());
+        std::vector<short> queue;
+        basic_sokoban_env replay(level_);
+        for (const push_type& push : get_seq()) {
+          // breadth first walk to the cell behind the box
+          int target = push.first - offset(push.second);
+          std::fill(from.begin(), from.end(), -1);
+          queue.assign(1, replay.player_);
+          from[replay.player_] = replay.player_;
+          for (std::size_t head = 0; head < queue.size() && from[target] == -1; head++) {
+            int cell = queue[head];
+            for (direction dir : dirs) {
+              int next = cell + offset(dir);
+              if (from[next] == -1 && replay.is_open(next)) {
+                from[next] = cell;
+                queue.push_back(next);
+              }
+            }
           }
+          std::size_t walk_start = solution.size();
+          for (int cell = target; cell != replay.player_; cell = from[cell]) {
+            int prev = from[cell];
+            for (direction dir : dirs) {
+              if (prev + offset(dir) == cell) {
+                solution.push_back(dir);
+              }
+            }
+          }
+          std::reverse(solution.begin() + walk_start, solution.end());
+          solution.push_back(push.second);
+          replay.step(push);
         }
-        Q.erase(min_elem_it);
+        return solution;
       }
-      int dist_to_dest = dist[dest];
-      dist_[src_dest_pair] = dist_to_dest;
-      return dist[dest];
     }
 
-    int absolute_distance(position_type src, position_type dest) {
-      return std::abs(src.first - dest.first) + std::abs(src.first - dest.first);
-    }
-
-    std::vector<int> generate_seq_vec(int n) {
-      std::vector<int> tmp;
-      for (int i = 0; i < n; i++) {
-        tmp.push_back(i);
+    void print_seq() const {
+      std::cout << "seq: ";
+      for (auto move : get_solution()) {
+        std::cout << get_dir_str(move) << " ";
       }
-      return tmp;
+      std::cout << std::endl;
     }
 
-    std::vector<std::vector<std::pair<int, int>>> generate_matches(int n) const {
-      std::vector<int> box_inds;
-      for (int i = 0; i < n; i++) {
-        box_inds.push_back(i);
-      }
-      std::vector<int> goal_inds(box_inds);
-      std::vector<std::vector<std::pair<int, int>>> matches;
-
-      do {
-        std::vector<std::pair<int, int>> match;
-        for (int i = 0; i < n; i++) {
-          match.push_back(std::make_pair(goal_inds[i], box_inds[i]));
+    // Lower bound on the pushes left: the cheapest matching of boxes to
+    // goals under the push distance table, capped at unreachable. It only
+    // depends on the boxes, so it is memoised per level.
+    int get_reward() const {
+      std::size_t key_hash = boxes_.hash();
+      int reward;
+      if (level_->reward_cache.find(boxes_, key_hash, reward)) {
+        return reward;
+      }
+
+      static thread_local min_cost_assignment assignment;
+      int num_boxes = boxes_.count();
+      int num_goals = level_->goals.size();
+      assignment.resize(num_boxes, num_goals);
+      int b = 0;
+      boxes_.for_each([&](int i) {
+        for (int g = 0; g < num_goals; g++) {
+          assignment.cost(b, g) = level_->dist(level_->cells[i], g);
         }
-        matches.push_back(match);
-      } while (std::next_permutation(goal_inds.begin(), goal_inds.end()));
-      return matches;
+        b++;
+      });
+      int min_cost = std::min<int>(assignment.solve(), level_type::unreachable);
+      reward = -min_cost + 100 * get_num_correct_boxes();
+      level_->reward_cache.insert(boxes_, key_hash, reward);
+      return reward;
     }
 
-    int get_reward() const {
-      for (auto i = box_positions_.begin(); i != box_positions_.end(); ++i) {
-        for (auto j = goal_positions_.begin(); j != goal_positions_.end(); ++j) {
-          shortest_distance_path(*i, *j);
-        } 
-      } 
-
-      int min_cost = 9999;
-
-      int n = box_positions_.size();
-      auto matchings = generate_matches(n);
-      for (auto& matching : matchings) {
-        int cost = 0;
-        for (auto& match : matching) {
-          cost += shortest_distance_path(box_positions_[match.first],
-              goal_positions_[match.second]);
-        }
-        min_cost = std::min(cost, min_cost);
-      }
-      return -min_cost + 100 * get_num_correct_boxes();
+    // Admissible estimate of the pushes still needed, from the same
+    // memoised matching; unreachable or more means no solution.
+    int get_lower_bound() const {
+      return 100 * get_num_correct_boxes() - get_reward();
     }
 
-    void step(direction dir) {
+    void step(move_type move) {
       num_moves_++;
-      board_[human_pos_.first][human_pos_.second] = ' ';
-      seq_.push_back(dir);
-
-      position_type pos = get_shifted_position(human_pos_, dir);
+      seq_ = std::make_shared<const seq_node>(seq_node{move, std::move(seq_)});
 
-      char tile = board_[pos.first][pos.second];
-
-      if (!is_goal_or_free(tile)) {
-        // its a box
-        position_type new_box_pos = get_shifted_position(pos, dir);
-
-        auto box_pos = std::find(box_positions_.begin(), box_positions_.end(), pos);
-        box_pos->first = new_box_pos.first;
-        box_pos->second = new_box_pos.second;
-
-        board_[new_box_pos.first][new_box_pos.second] = '$';
-      }
-
-      board_[pos.first][pos.second] = '@';
-      human_pos_.first = pos.first;
-      human_pos_.second = pos.second;
-
-      for (auto it = goal_positions_.begin(); it != goal_positions_.end(); ++it) {
-        auto& board_pos = board_[it->first][it->second];
-        if (board_pos == ' ') {
-          board_pos = '.';
-        }
-      }
-
-      if (is_game_over()) {
+      int pos;
+      direction dir;
+      if constexpr (PushMoves) {
+        pos = move.first;
+        dir = move.second;
+      } else {
+        pos = player_ + offset(move);
+        dir = move;
+      }
+      if (is_box(pos)) {
+        int dest = pos + offset(dir);
+        boxes_.reset(level_->interior[pos]);
+        boxes_.set(level_->interior[dest]);
+        is_deadlocked_ = is_deadlocked_ || !level_->live[dest] ||
+          level_->is_freeze_deadlock(boxes_, dest) || level_->is_pattern_deadlock(boxes_, dest);
+      }
+      player_ = pos;
+
+      if constexpr (PushMoves) {
+        bool any_push = has_push();
+        is_game_over_ = is_game_over() || !any_push;
+      } else if (is_game_over()) {
         is_game_over_ = true;
       }
     }
 
-    void render() {
+    void render() const {
+      int rows = level_->rows - 2;
+      int cols = level_->cols - 2;
       std::cout << "  ";
-      for (int k = 0; k < board_.size(); k++) {
-        std::cout << k; 
+      for (int k = 0; k < cols; k++) {
+        std::cout << k;
       }
       std::cout << std::endl << std::endl;
 
-      for (int i = 0; i < board_.size(); i++) {
+      for (int i = 0; i < rows; i++) {
         std::cout << i << " ";
-        for (int j = 0; j < board_[i].size(); j++) {
-          char tile = board_[i][j];
-          if (tile == '#') {
-            std::cout << "\033[91m#\033[0m";
-          } else if (tile == '.') {
-            std::cout << "\033[92m.\033[0m";
-          } else if (tile == '$') {
-            std::cout << "\033[93m$\033[0m";
-          } else if (tile == '@') {
+        for (int j = 0; j < cols; j++) {
+          int cell = level_->index(i, j);
+          if (level_->wall[cell]) {
+            // only the walls that bound the interior are drawn
+            bool bounds = false;
+            for (int di = -1; di <= 1; di++) {
+              for (int dj = -1; dj <= 1; dj++) {
+                bounds = bounds || level_->interior[cell + di * level_->cols + dj] != -1;
+              }
+            }
+            std::cout << (bounds ? "\033[91m#\033[0m" : " ");
+          } else if (cell == player_) {
             std::cout << "\033[94m@\033[0m";
+          } else if (is_box(cell)) {
+            std::cout << "\033[93m$\033[0m";
+          } else if (level_->goal[cell]) {
+            std::cout << "\033[92m.\033[0m";
           } else {
             std::cout << " ";
           }
@@ -523,14 +479,18 @@ class sokoban_env {
     }
 
     static move_type root_state() {
-      return direction::null;
+      if constexpr (PushMoves) {
+        return push_type(-1, direction::null);
+      } else {
+        return direction::null;
+      }
     }
 
     class rollout_move_getter {
       private:
-        sokoban_env* parent_;
+        basic_sokoban_env* parent_;
       public:
-        rollout_move_getter(sokoban_env* parent)
+        rollout_move_getter(basic_sokoban_env* parent)
           : parent_(parent)
         {}
 
@@ -543,3 +503,6 @@ class sokoban_env {
       return rollout_move_getter(this);
     }
 };
+
+using sokoban_env = basic_sokoban_env<false>;
+using sokoban_push_env = basic_sokoban_env<true>;
@@ -0,0 +1,442 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "bounded_cache.hpp"
+#include "deadlock_patterns.hpp"
+
+// Fixed-capacity bitset over the interior cells of a level. Sokoban states
+// keep their boxes in one of these, so a copy is a handful of words and
+// membership is a shift and a mask.
+class cell_set {
+  public:
+    static constexpr int capacity = 512;
+  private:
+    static constexpr int num_words = capacity / 64;
+    std::array<std::uint64_t, num_words> words_{};
+  public:
+    bool test(int i) const {
+      return (words_[i >> 6] >> (i & 63)) & 1;
+    }
+
+    void set(int i) {
+      words_[i >> 6] |= std::uint64_t(1) << (i & 63);
+    }
+
+    void reset(int i) {
+      words_[i >> 6] &= ~(std::uint64_t(1) << (i & 63));
+    }
+
+    int count() const {
+      int n = 0;
+      for (std::uint64_t word : words_) {
+        n += __builtin_popcountll(word);
+      }
+      return n;
+    }
+
+    // The n <= 57 bits from index first on, as the low bits of a word.
+    std::uint64_t bits(int first, int n) const {
+      int w = first >> 6;
+      int shift = first & 63;
+      std::uint64_t low = words_[w] >> shift;
+      if (shift && w + 1 < num_words) {
+        low |= words_[w + 1] << (64 - shift);
+      }
+      return low & ((std::uint64_t(1) << n) - 1);
+    }
+
+    int count_common(const cell_set& other) const {
+      int n = 0;
+      for (int w = 0; w < num_words; w++) {
+        n += __builtin_popcountll(words_[w] & other.words_[w]);
+      }
+      return n;
+    }
+
+    // Calls f with the index of every set bit, in increasing order.
+    template <class F>
+    void for_each(F f) const {
+      for (int w = 0; w < num_words; w++) {
+        std::uint64_t word = words_[w];
+        while (word) {
+          f(w * 64 + __builtin_ctzll(word));
+          word &= word - 1;
+        }
+      }
+    }
+
+    std::size_t hash() const {
+      // FNV-1a over the words
+      std::size_t h = 14695981039346656037ULL;
+      for (std::uint64_t word : words_) {
+        h = (h ^ word) * 1099511628211ULL;
+      }
+      return h;
+    }
+
+    bool operator==(const cell_set& other) const {
+      return words_ == other.words_;
+    }
+
+    bool operator!=(const cell_set& other) const {
+      return words_ != other.words_;
+    }
+};
+
+// Everything about a Sokoban level that does not change while it is
+// played: walls, goals, the interior cells and the push distance tables.
+// It is built once when the level is read and shared by pointer between
+// every state of that level.
+//
+// The grid is padded with a ring of wall, so the four neighbours of any
+// interior cell are always valid indices. Floor outside the area the
+// player, boxes and goals can reach is treated as wall too.
+struct sokoban_level {
+  // minimum number of pushes from each cell to each goal, goal-major,
+  // ignoring the other boxes; unreachable cells hold unreachable
+  using dist_table = std::vector<std::uint16_t>;
+  static constexpr std::uint16_t unreachable = 9999;
+
+  int rows = 0;
+  int cols = 0;
+  // per grid cell
+  std::vector<char> wall;
+  std::vector<char> goal;
+  // a box on this cell can still be pushed onto some goal
+  std::vector<char> live;
+  // grid cell -> interior index, or -1 for wall
+  std::vector<short> interior;
+  // interior index -> grid cell
+  std::vector<short> cells;
+  // grid cells of the goals in the order they appear in the level
+  std::vector<short> goals;
+  cell_set goal_set;
+  dist_table goal_dist;
+  // reward by box configuration, filled by the envs as they score states
+  bounded_cache<cell_set, int> reward_cache;
+  // local deadlocks checked on every push, see deadlock_patterns
+  const deadlock_patterns* patterns = &deadlock_patterns::shared();
+
+  cell_set start_boxes;
+  short start_player = -1;
+
+  // Parses a level in the usual text format: '#' wall, '@' player, '$' box,
+  // '.' goal, '*' box on goal, '+' player on goal, anything else floor.
+  explicit sokoban_level(const std::vector<std::string>& lines) {
+    rows = lines.size() + 2;
+    cols = 0;
+    for (auto& line : lines) {
+      cols = std::max<int>(cols, line.size());
+    }
+    cols += 2;
+    if (rows * cols > 32767) {
+      throw std::runtime_error("sokoban level too large");
+    }
+
+    int num_cells = rows * cols;
+    wall.assign(num_cells, 1);
+    goal.assign(num_cells, 0);
+    std::vector<short> boxes;
+    for (int i = 0; i < (int) lines.size(); i++) {
+      for (int j = 0; j < (int) lines[i].size(); j++) {
+        int cell = index(i, j);
+        char tile = lines[i][j];
+        wall[cell] = tile == '#';
+        if (tile == '.' || tile == '*' || tile == '+') {
+          goal[cell] = 1;
+          goals.push_back(cell);
+        }
+        if (tile == '$' || tile == '*') {
+          boxes.push_back(cell);
+        }
+        if (tile == '@' || tile == '+') {
+          start_player = cell;
+        }
+      }
+    }
+    if (start_player == -1) {
+      throw std::runtime_error("sokoban level has no player");
+    }
+    if (boxes.size() > goals.size()) {
+      throw std::runtime_error("sokoban level has more boxes than goals");
+    }
+
+    // interior: floor connected to the player, a box or a goal
+    interior.assign(num_cells, -1);
+    std::vector<short> stack(boxes);
+    stack.insert(stack.end(), goals.begin(), goals.end());
+    stack.push_back(start_player);
+    std::vector<char> seen(num_cells, 0);
+    while (!stack.empty()) {
+      int cell = stack.back();
+      stack.pop_back();
+      if (seen[cell] || wall[cell]) {
+        continue;
+      }
+      if (cell < cols || cell >= num_cells - cols || cell % cols == 0 || cell % cols == cols - 1) {
+        throw std::runtime_error("sokoban level is not enclosed by walls");
+      }
+      seen[cell] = 1;
+      for (int off : {-cols, 1, cols, -1}) {
+        stack.push_back(cell + off);
+      }
+    }
+    for (int cell = 0; cell < num_cells; cell++) {
+      if (seen[cell]) {
+        interior[cell] = cells.size();
+        cells.push_back(cell);
+      } else {
+        wall[cell] = 1;
+      }
+    }
+    if (cells.size() > cell_set::capacity) {
+      throw std::runtime_error("sokoban level has too many floor cells");
+    }
+
+    for (short cell : goals) {
+      goal_set.set(interior[cell]);
+    }
+    for (short cell : boxes) {
+      start_boxes.set(interior[cell]);
+    }
+
+    build_goal_distances();
+    build_pattern_areas();
+  }
+
+  static std::shared_ptr<const sokoban_level> from_file(const std::string& path) {
+    std::ifstream file(path);
+    if (!file) {
+      throw std::runtime_error("cannot open " + path);
+    }
+    std::vector<std::string> lines;
+    std::string line;
+    while (std::getline(file, line)) {
+      lines.push_back(line);
+    }
+    return std::make_shared<const sokoban_level>(lines);
+  }
+
+  // grid cell of row i, column j of the level text
+  int index(int i, int j) const {
+    return (i + 1) * cols + j + 1;
+  }
+
+  int num_cells() const {
+    return rows * cols;
+  }
+
+  int dist(int cell, int goal_index) const {
+    return goal_dist[goal_index * num_cells() + cell];
+  }
+
+  bool has_box(const cell_set& boxes, int cell) const {
+    return interior[cell] >= 0 && boxes.test(interior[cell]);
+  }
+
+  // Freeze deadlock test for the box on cell, usually the one just pushed.
+  // A box is frozen when it can move along neither axis. An axis is
+  // blocked by a wall on either side, by dead squares on both sides, or by
+  // a neighbouring box that is frozen itself. Only the boxes around the
+  // pushed one are visited, and those under test count as walls, so mutual
+  // blocks terminate. It is a deadlock when a frozen box is off its goal.
+  bool is_freeze_deadlock(const cell_set& boxes, int cell) const {
+    cell_set testing;
+    bool off_goal = false;
+    return is_frozen(boxes, cell, testing, off_goal) && off_goal;
+  }
+
+  // Pattern test for the box on cell: whether any goal-free window over it
+  // holds a known deadlock.
+  bool is_pattern_deadlock(const cell_set& boxes, int cell) const {
+    if (pattern_areas.empty()) {
+      return false;
+    }
+    const pattern_area& area = pattern_areas[interior[cell]];
+    int width = patterns->width();
+    int height = patterns->height();
+    int span = 2 * width - 1;
+    std::uint64_t near = 0;
+    for (int r = 0; r < area.num_runs; r++) {
+      const pattern_area::run& run = area.runs[r];
+      near |= boxes.bits(run.first, run.length) << run.bit;
+    }
+
+    // a pattern has at least two boxes; a window with more than the set
+    // was built for is simply not found
+    int size = width * height;
+    std::uint32_t row_mask = (1u << width) - 1;
+    for (int w = 0; w < size; w++) {
+      std::uint64_t in_window = near & window_masks[w];
+      if (area.walls[w] < 0 || !(in_window & (in_window - 1))) {
+        continue;
+      }
+      int top = w / width;
+      int left = w % width;
+      std::uint32_t box_bits = 0;
+      for (int r = 0; r < height; r++) {
+        box_bits |= std::uint32_t(near >> ((top + r) * span + left) & row_mask) << (r * width);
+      }
+      if (patterns->contains(std::uint32_t(area.walls[w]) << size | box_bits)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Whole-state check, for states that were not reached by a checked push:
+  // a box on a dead square, frozen off a goal or in a deadlock pattern.
+  bool is_deadlock(const cell_set& boxes) const {
+    bool deadlock = false;
+    boxes.for_each([&](int i) {
+      int cell = cells[i];
+      deadlock = deadlock || !live[cell] || is_freeze_deadlock(boxes, cell) ||
+        is_pattern_deadlock(boxes, cell);
+    });
+    return deadlock;
+  }
+
+  private:
+    // The cells a pattern window over one interior cell can cover: the
+    // (2 * height - 1) x (2 * width - 1) block centred on it, row-major.
+    // Boxes in the block are gathered into one word, a run of floor in a
+    // block row at a time, since a run has consecutive interior indices.
+    // Each window's bits are then a few shifts. Windows are numbered by
+    // their top left corner in the block and hold their walls, with cells
+    // off the grid counted as wall, or -1 when they cover a goal.
+    struct pattern_area {
+      struct run {
+        short first;
+        std::uint8_t length;
+        std::uint8_t bit;
+      };
+      // a block row of 2 * width - 1 cells has at most width runs
+      std::array<run, 2 * deadlock_patterns::max_cells> runs;
+      int num_runs = 0;
+      std::array<std::int32_t, deadlock_patterns::max_cells> walls{};
+    };
+
+    // by interior index, empty without patterns
+    std::vector<pattern_area> pattern_areas;
+    // the block cells of each window
+    std::array<std::uint64_t, deadlock_patterns::max_cells> window_masks{};
+
+    bool is_frozen(const cell_set& boxes, int cell, cell_set& testing, bool& off_goal) const {
+      testing.set(interior[cell]);
+      bool chain_off_goal = !goal[cell];
+      bool frozen = is_axis_blocked(boxes, cell, 1, testing, chain_off_goal) &&
+        is_axis_blocked(boxes, cell, cols, testing, chain_off_goal);
+      if (frozen) {
+        off_goal = off_goal || chain_off_goal;
+      } else {
+        // a box that can move is no wall for its neighbours
+        testing.reset(interior[cell]);
+      }
+      return frozen;
+    }
+
+    bool is_axis_blocked(const cell_set& boxes, int cell, int off, cell_set& testing, bool& off_goal) const {
+      int a = cell - off;
+      int b = cell + off;
+      if (wall[a] || wall[b] || testing.test(interior[a]) || testing.test(interior[b])) {
+        return true;
+      }
+      if (!live[a] && !live[b]) {
+        return true;
+      }
+      return (has_box(boxes, a) && is_frozen(boxes, a, testing, off_goal)) ||
+        (has_box(boxes, b) && is_frozen(boxes, b, testing, off_goal));
+    }
+
+    // A deadlock a push creates involves the pushed box, so only the
+    // windows over the box it lands on need checking.
+    void build_pattern_areas() {
+      if (patterns->empty()) {
+        return;
+      }
+      int width = patterns->width();
+      int height = patterns->height();
+      int span = 2 * width - 1;
+      for (int w = 0; w < width * height; w++) {
+        for (int c = 0; c < width * height; c++) {
+          int bit = (w / width + c / width) * span + w % width + c % width;
+          window_masks[w] |= std::uint64_t(1) << bit;
+        }
+      }
+
+      pattern_areas.resize(cells.size());
+      for (std::size_t i = 0; i < cells.size(); i++) {
+        pattern_area& area = pattern_areas[i];
+        int top_row = cells[i] / cols - height + 1;
+        int left_col = cells[i] % cols - width + 1;
+        std::uint64_t floor = 0;
+        std::uint64_t goals_near = 0;
+        for (int c = 0; c < (2 * height - 1) * span; c++) {
+          int row = top_row + c / span;
+          int col = left_col + c % span;
+          int at = row * cols + col;
+          if (row < 0 || row >= rows || col < 0 || col >= cols || interior[at] < 0) {
+            continue;
+          }
+          floor |= std::uint64_t(1) << c;
+          goals_near |= std::uint64_t(goal[at]) << c;
+          if (c % span > 0 && (floor >> (c - 1) & 1)) {
+            area.runs[area.num_runs - 1].length++;
+          } else {
+            area.runs[area.num_runs++] = pattern_area::run{interior[at], 1, std::uint8_t(c)};
+          }
+        }
+
+        for (int top = 0; top < height; top++) {
+          for (int left = 0; left < width; left++) {
+            std::int32_t walls = 0;
+            for (int c = 0; c < width * height; c++) {
+              int bit = (top + c / width) * span + left + c % width;
+              if (goals_near >> bit & 1) {
+                walls = -1;
+                break;
+              }
+              walls |= std::int32_t(!(floor >> bit & 1)) << c;
+            }
+            area.walls[top * width + left] = walls;
+          }
+        }
+      }
+    }
+
+    // Reverse push search from every goal: a box reaches u by a push in
+    // direction d from u - d, with the player standing at u - 2 * d, so both
+    // of those cells must be floor. A cell no goal reaches is dead.
+    void build_goal_distances() {
+      int n = num_cells();
+      goal_dist.assign(goals.size() * n, unreachable);
+      live.assign(n, 0);
+      std::vector<short> queue;
+      for (std::size_t g = 0; g < goals.size(); g++) {
+        std::uint16_t* dist = &goal_dist[g * n];
+        queue.clear();
+        queue.push_back(goals[g]);
+        dist[goals[g]] = 0;
+        for (std::size_t head = 0; head < queue.size(); head++) {
+          int cur = queue[head];
+          live[cur] = 1;
+          for (int off : {-cols, 1, cols, -1}) {
+            int box_from = cur + off;
+            int player_from = box_from + off;
+            if (player_from >= 0 && player_from < n &&
+                !wall[box_from] && !wall[player_from] &&
+                dist[box_from] == unreachable) {
+              dist[box_from] = dist[cur] + 1;
+              queue.push_back(box_from);
+            }
+          }
+        }
+      }
+    }
+};
@@ -0,0 +1,125 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "sokoban_level.hpp"
+
+struct sokoban_pack_entry {
+  std::string name;
+  // null when the level could not be built, error says why
+  std::shared_ptr<const sokoban_level> level;
+  std::string error;
+};
+
+namespace sokoban_pack_detail {
+
+inline bool is_level_row(const std::string& line) {
+  bool has_wall = false;
+  for (char c : line) {
+    if (c == '#') {
+      has_wall = true;
+    } else if (std::string(" @+$*.-_\t\r").find(c) == std::string::npos) {
+      return false;
+    }
+  }
+  return has_wall;
+}
+
+inline std::string trim(const std::string& s) {
+  std::size_t begin = s.find_first_not_of(" \t\r");
+  std::size_t end = s.find_last_not_of(" \t\r");
+  return begin == std::string::npos ? "" : s.substr(begin, end - begin + 1);
+}
+
+}
+
+// Reads a level pack in the XSB format: levels are blocks of rows of
+// "#@+$*.", with '-' or '_' also accepted as floor, separated by anything
+// else. A "Title:" line after a level names it; otherwise the last comment
+// line (";" prefix) between it and the previous level does, and failing
+// both it is "level N". A title before the first level names the pack,
+// not a level, and is skipped. Every level is built into its own
+// immutable sokoban_level, with its tables, on num_threads threads. A
+// level that fails to build gets a null level and an error instead of
+// aborting the pack.
+inline std::vector<sokoban_pack_entry> load_sokoban_pack(const std::string& path,
+    unsigned num_threads = std::thread::hardware_concurrency()) {
+  std::ifstream in(path);
+  if (!in) {
+    throw std::runtime_error("cannot open " + path);
+  }
+
+  std::vector<sokoban_pack_entry> entries;
+  std::vector<std::vector<std::string>> level_rows;
+  std::vector<std::string> pending;
+  std::string comment;
+  // whether the last level already has its title
+  bool titled = false;
+
+  auto flush = [&]() {
+    if (pending.empty()) {
+      return;
+    }
+    sokoban_pack_entry entry;
+    entry.name = comment.empty() ? "level " + std::to_string(entries.size() + 1) : comment;
+    titled = false;
+    entries.push_back(entry);
+    level_rows.push_back(pending);
+    pending.clear();
+    comment.clear();
+  };
+
+  std::string line;
+  while (std::getline(in, line)) {
+    if (sokoban_pack_detail::is_level_row(line)) {
+      std::string row = line;
+      std::replace(row.begin(), row.end(), '-', ' ');
+      std::replace(row.begin(), row.end(), '_', ' ');
+      row.erase(std::remove(row.begin(), row.end(), '\r'), row.end());
+      pending.push_back(row);
+      continue;
+    }
+    flush();
+
+    std::string text = sokoban_pack_detail::trim(line);
+    if (text.rfind("Title:", 0) == 0) {
+      std::string title = sokoban_pack_detail::trim(text.substr(6));
+      if (!entries.empty() && !titled && !title.empty()) {
+        entries.back().name = title;
+        titled = true;
+        // comments up to here were about the titled level
+        comment.clear();
+      }
+    } else if (!text.empty() && text[0] == ';') {
+      comment = sokoban_pack_detail::trim(text.substr(1));
+    }
+  }
+  flush();
+
+  std::atomic<std::size_t> next(0);
+  auto build = [&]() {
+    for (std::size_t i = next++; i < entries.size(); i = next++) {
+      try {
+        entries[i].level = std::make_shared<const sokoban_level>(level_rows[i]);
+      } catch (const std::exception& e) {
+        entries[i].error = e.what();
+      }
+    }
+  };
+  std::vector<std::thread> workers;
+  num_threads = std::max(1u, std::min<unsigned>(num_threads, entries.size()));
+  for (unsigned t = 1; t < num_threads; t++) {
+    workers.emplace_back(build);
+  }
+  build();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+
+  return entries;
+}
@@ -0,0 +1,298 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "deadlock_patterns.hpp"
+
+// Builds the deadlock pattern file that sokoban_level checks pushes
+// against. For every layout of walls in a width x height window, every
+// placement of up to max_boxes boxes on its floor is solved by retrograde
+// analysis: the floor around the window is free and boxes pushed out of it
+// are gone, so a placement is alive when some push leads to a live
+// placement and the empty window is alive. Placements are done in order of
+// box count, since a push either keeps the count or lowers it, and within
+// one count the live set grows to a fixed point. The player's position
+// matters only through its region, so a state is a placement and a region.
+// A placement that no region can clear is written as a pattern, unless
+// the dead square and freeze tests already catch it.
+//
+//   sokoban_patterns [out=skbn_cfgs/deadlock_patterns.db] [width=4] [height=4] [max_boxes=4] [threads=all]
+
+namespace {
+
+struct window {
+  int width;
+  int height;
+  int cells;
+  // neighbour of each cell in each direction, or -1 outside the window
+  std::vector<std::array<int, 4>> next;
+
+  window(int w, int h) : width(w), height(h), cells(w * h), next(cells) {
+    for (int c = 0; c < cells; c++) {
+      int i = c / w;
+      int j = c % w;
+      next[c] = {
+        i > 0 ? c - w : -1,
+        j < w - 1 ? c + 1 : -1,
+        i < h - 1 ? c + w : -1,
+        j > 0 ? c - 1 : -1,
+      };
+    }
+  }
+
+  bool on_border(int c) const {
+    for (int n : next[c]) {
+      if (n < 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+};
+
+// The free cells of one window split into player regions. Cells on the
+// border all join the outside, which is region cells.
+struct regions {
+  std::uint8_t of[deadlock_patterns::max_cells + 1];
+  std::uint32_t present = 0;
+};
+
+class pattern_solver {
+  private:
+    const window& win_;
+    int max_boxes_;
+    std::uint32_t walls_ = 0;
+    // live regions, as a bit set over region ids, by box placement
+    std::vector<std::uint32_t> live_;
+    std::vector<regions> regions_;
+    std::vector<char> visited_;
+    std::vector<std::uint32_t> touched_;
+
+    const regions& regions_for(std::uint32_t boxes) {
+      if (visited_[boxes]) {
+        return regions_[boxes];
+      }
+      visited_[boxes] = 1;
+      touched_.push_back(boxes);
+      regions& r = regions_[boxes];
+      r.present = 0;
+      std::uint32_t blocked = walls_ | boxes;
+      const int outside = win_.cells;
+      std::fill(std::begin(r.of), std::end(r.of), 0xff);
+      r.of[outside] = outside;
+      int stack[deadlock_patterns::max_cells];
+      for (int c = 0; c < win_.cells; c++) {
+        if ((blocked >> c & 1) || r.of[c] != 0xff) {
+          continue;
+        }
+        // a region touching the border is the outside
+        int id = c;
+        int top = 0;
+        stack[top++] = c;
+        r.of[c] = c;
+        int members[deadlock_patterns::max_cells];
+        int num_members = 0;
+        while (top) {
+          int cur = stack[--top];
+          members[num_members++] = cur;
+          if (win_.on_border(cur)) {
+            id = outside;
+          }
+          for (int n : win_.next[cur]) {
+            if (n >= 0 && !(blocked >> n & 1) && r.of[n] == 0xff) {
+              r.of[n] = c;
+              stack[top++] = n;
+            }
+          }
+        }
+        for (int m = 0; m < num_members; m++) {
+          r.of[members[m]] = id;
+        }
+        r.present |= 1u << id;
+      }
+      r.present |= 1u << outside;
+      return r;
+    }
+
+    bool is_wall(int c) const {
+      return c >= 0 && (walls_ >> c & 1);
+    }
+
+    bool is_box(std::uint32_t boxes, int c) const {
+      return c >= 0 && (boxes >> c & 1);
+    }
+
+    bool is_dead_square(int c) const {
+      return c >= 0 && !(walls_ >> c & 1) && live_[1u << c] == 0;
+    }
+
+    // The window-only version of sokoban_level::is_freeze_deadlock, with
+    // the floor outside the window free. Whatever it finds, the level's
+    // own check finds too.
+    bool is_frozen(std::uint32_t boxes, int b, std::uint32_t& testing) const {
+      testing |= 1u << b;
+      bool frozen = true;
+      for (int axis = 0; axis < 2 && frozen; axis++) {
+        int a = win_.next[b][axis];
+        int c = win_.next[b][axis + 2];
+        frozen = is_wall(a) || is_wall(c) || is_box(testing, a) || is_box(testing, c) ||
+          (is_dead_square(a) && is_dead_square(c)) ||
+          (is_box(boxes, a) && is_frozen(boxes, a, testing)) ||
+          (is_box(boxes, c) && is_frozen(boxes, c, testing));
+      }
+      if (!frozen) {
+        testing &= ~(1u << b);
+      }
+      return frozen;
+    }
+
+    // Whether the checks sokoban_env already makes on every push catch the
+    // placement: a box on a dead square or a frozen box.
+    bool is_caught(std::uint32_t boxes) const {
+      for (int b = 0; b < win_.cells; b++) {
+        std::uint32_t testing = 0;
+        if (is_box(boxes, b) && (is_dead_square(b) || is_frozen(boxes, b, testing))) {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    // Whether the player in region can make a push to a live state.
+    bool has_live_push(std::uint32_t boxes, int region) {
+      const regions& r = regions_for(boxes);
+      for (int b = 0; b < win_.cells; b++) {
+        if (!(boxes >> b & 1)) {
+          continue;
+        }
+        for (int d = 0; d < 4; d++) {
+          int from = win_.next[b][(d + 2) % 4];
+          int to = win_.next[b][d];
+          int from_region = from < 0 ? win_.cells : r.of[from];
+          if (from_region != region) {
+            continue;
+          }
+          std::uint32_t after;
+          if (to < 0) {
+            after = boxes & ~(1u << b);
+          } else if ((walls_ | boxes) >> to & 1) {
+            continue;
+          } else {
+            after = (boxes & ~(1u << b)) | (1u << to);
+          }
+          // the player now stands where the box was
+          if (live_[after] >> regions_for(after).of[b] & 1) {
+            return true;
+          }
+        }
+      }
+      return false;
+    }
+  public:
+    pattern_solver(const window& win, int max_boxes)
+      : win_(win),
+        max_boxes_(max_boxes),
+        live_(std::size_t(1) << win.cells, 0),
+        regions_(std::size_t(1) << win.cells),
+        visited_(std::size_t(1) << win.cells, 0)
+    {
+    }
+
+    // Appends the dead placements for one wall layout to keys.
+    void solve(std::uint32_t walls, std::vector<std::uint32_t>& keys) {
+      for (std::uint32_t boxes : touched_) {
+        visited_[boxes] = 0;
+        live_[boxes] = 0;
+      }
+      touched_.clear();
+      walls_ = walls;
+
+      std::uint32_t floor = ~walls & ((1u << win_.cells) - 1);
+      std::vector<std::vector<std::uint32_t>> by_count(max_boxes_ + 1);
+      // every subset of the floor, by box count
+      for (std::uint32_t boxes = floor; ; boxes = (boxes - 1) & floor) {
+        int count = __builtin_popcount(boxes);
+        if (count <= max_boxes_) {
+          by_count[count].push_back(boxes);
+        }
+        if (boxes == 0) {
+          break;
+        }
+      }
+
+      live_[0] = regions_for(0).present;
+      for (int count = 1; count <= max_boxes_; count++) {
+        bool changed = true;
+        while (changed) {
+          changed = false;
+          for (std::uint32_t boxes : by_count[count]) {
+            std::uint32_t present = regions_for(boxes).present;
+            for (int region = 0; region <= win_.cells; region++) {
+              if ((present >> region & 1) && !(live_[boxes] >> region & 1) &&
+                  has_live_push(boxes, region)) {
+                live_[boxes] |= 1u << region;
+                changed = true;
+              }
+            }
+          }
+        }
+        for (std::uint32_t boxes : by_count[count]) {
+          if (live_[boxes] == 0 && !is_caught(boxes)) {
+            keys.push_back(walls << win_.cells | boxes);
+          }
+        }
+      }
+    }
+};
+
+}
+
+int main(int argc, char** argv) {
+  std::string out = argc > 1 ? argv[1] : "skbn_cfgs/deadlock_patterns.db";
+  int width = argc > 2 ? std::stoi(argv[2]) : 4;
+  int height = argc > 3 ? std::stoi(argv[3]) : 4;
+  int max_boxes = argc > 4 ? std::stoi(argv[4]) : 4;
+  unsigned num_threads = argc > 5 ? std::stoul(argv[5]) : std::thread::hardware_concurrency();
+  num_threads = std::max(1u, num_threads);
+  if (width < 1 || height < 1 || width * height > deadlock_patterns::max_cells) {
+    std::cerr << "the window must have between 1 and " << deadlock_patterns::max_cells << " cells" << std::endl;
+    return 1;
+  }
+
+  window win(width, height);
+  std::uint32_t num_layouts = 1u << win.cells;
+  std::atomic<std::uint32_t> next(0);
+  std::mutex keys_mutex;
+  std::vector<std::uint32_t> keys;
+
+  auto work = [&]() {
+    pattern_solver solver(win, max_boxes);
+    std::vector<std::uint32_t> found;
+    for (std::uint32_t walls = next++; walls < num_layouts; walls = next++) {
+      solver.solve(walls, found);
+    }
+    std::lock_guard<std::mutex> lock(keys_mutex);
+    keys.insert(keys.end(), found.begin(), found.end());
+  };
+  std::vector<std::thread> workers;
+  for (unsigned t = 1; t < num_threads; t++) {
+    workers.emplace_back(work);
+  }
+  work();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+
+  try {
+    deadlock_patterns::write(out, width, height, max_boxes, keys);
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  std::cout << keys.size() << " patterns written to " << out << std::endl;
+}
@@ -13,15 +13,13 @@ failures. For this reason, we can see that the largest possible value of
 r to look at is the smallest d in the dataset.
 '''
 
+# terminal depth -> count, from the summary search() writes
 tds = dict()
-with open('td', 'r') as td_f:
-    lines = [int(line) for line in td_f.readlines()]
-
-for line in lines:
-    if line not in tds:
-        tds[line] = 1
-    else:
-        tds[line] += 1
+with open('tree_stats', 'r') as ts_f:
+    for line in ts_f:
+        fields = line.split()
+        if fields[0] == 'terminal':
+            tds[int(fields[1])] = int(fields[2])
 
 def log_likelihood(x, r, p):
     if r == 0 or p == 1 or p == 0:
@@ -1,3 +1,7 @@
+# Splits the raw tree_info dump, written by search() with raw_tree_info
+# set, into the per-group file gr.py reads. nc.py and td.py read the
+# tree_stats summary instead.
+
 with open('tree_info', 'r') as ti:
     lines = [line[:-1] for line in ti.readlines()]
 
@@ -8,12 +8,15 @@ int main() {
   std::ofstream gv("v8.gv");
   gv << m.to_gv();
 
-  std::ofstream td("td");
+  // in the tree_stats format td.py and hist.py read
+  std::ofstream ts("tree_stats");
 
   auto& terminal_depths = m.get_terminal_depths();
 
-  for (auto& elem : terminal_depths) {
-    td << elem << std::endl;
+  for (std::size_t depth = 0; depth < terminal_depths.size(); depth++) {
+    if (terminal_depths[depth]) {
+      ts << "terminal " << depth << " " << terminal_depths[depth] << std::endl;
+    }
   }
 
 }
@@ -1,27 +1,34 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <cmath>
-#include <cstdlib>
+#include <cstdint>
 #include <iostream>
 #include <limits>
 #include <random>
 #include <sstream>
+#include <stdexcept>
 #include <vector>
 
-#define P1 0.4
-#define P2 0.2
-
-#define N1 4
-#define N2 16
-
-static std::size_t node_id = 0;
-static std::random_device rd;
-static std::mt19937 gen(rd());
-static std::uniform_real_distribution<> dis(0.0, 1.0);
-static std::negative_binomial_distribution<> nb(20, 0.75);
-static std::normal_distribution<> norm{100,20};
+// Parameters of the synthetic tree. Each node draws one of two regimes
+// with even odds; regime 1 adds a failure with probability p1 and ends the
+// game at n1 failures, regime 2 likewise with p2 and n2.
+struct v8_params {
+  double p1 = 0.4;
+  double p2 = 0.2;
+  int n1 = 4;
+  int n2 = 16;
+  // negative binomial (r, p) for the number of children
+  int nb_r = 20;
+  double nb_p = 0.75;
+  // normal (mean, sd) for the reward
+  double reward_mean = 100;
+  double reward_sd = 20;
+};
 
-static std::vector<int> terminal_depths;
+// shared by every tree, so v8_sweep's parallel runs need it atomic
+static std::atomic<std::size_t> node_id(0);
 
 template <class T>
 double ucb1(const T* cur) {
@@ -37,57 +44,168 @@ double ucb1(const T* cur) {
   return q_bar + c * std::sqrt(std::log(parent_n) / n);
 }
 
-class node {
-  public:
-
+// A node of the synthetic tree as synthetic_tree derives it.
+class synthetic_point {
   private:
-    node* parent_;
-    std::vector<node> children_;
-    bool is_terminal_;
-    double q_;
-    int n_;
+    friend class synthetic_tree;
+
+    std::uint64_t key_;
     int depth_;
     int failures_;
     int max_children_;
-    std::size_t node_id_;
     double reward_;
   public:
-    node(node* parent = nullptr)
-      : parent_(parent),
-        failures_(parent ? parent->get_failures() : 0),
-        depth_(parent ? parent->get_depth() + 1 : 1),
-        q_(0), n_(0), node_id_(node_id++)
-    {
+    std::uint64_t get_key() const {
+      return key_;
+    }
+
+    int get_depth() const {
+      return depth_;
+    }
 
-      bool d1 = dis(gen) > .5;
-      double p_thresh = d1 ? P1 : P2;
-      double n_thresh = d1 ? N1 : N2;
+    int get_failures() const {
+      return failures_;
+    }
 
-      if (dis(gen) < p_thresh) {
-        failures_++;
+    int max_children() const {
+      return max_children_;
+    }
+
+    bool is_terminal() const {
+      return max_children_ == 0;
+    }
+
+    double get_reward() const {
+      return reward_;
+    }
+};
+
+// The synthetic tree for one parameter setting and seed. A node's
+// attributes are a pure function of its key, which is a hash of the
+// parent's key and the child's index, so the whole tree is fixed by the
+// seed and any path through it can be walked without building it. A node
+// first draws its regime, which may add a failure; failures add up along
+// the path. A live node has a negative binomial number of children, and
+// every node has a normal reward.
+class synthetic_tree {
+  private:
+    v8_params params_;
+    std::uint64_t seed_;
+    // inverse CDF of the child count, up to where the tail is negligible
+    std::vector<double> children_cdf_;
+
+    // longest child count CDF a setting may need, about a million children
+    static constexpr std::size_t max_cdf_size = 1 << 20;
+
+    // splitmix64's finalizer
+    static std::uint64_t mix(std::uint64_t x) {
+      x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+      x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+      return x ^ (x >> 31);
+    }
+
+    // the i-th uniform in [0, 1) drawn from a key
+    static double uniform(std::uint64_t key, int i) {
+      return (mix(key + (i + 1) * 0x9e3779b97f4a7c15ULL) >> 11) * 0x1.0p-53;
+    }
+
+    synthetic_point make(std::uint64_t key, int depth, int failures) const {
+      synthetic_point point;
+      point.key_ = key;
+      point.depth_ = depth;
+      point.failures_ = failures;
+
+      bool d1 = uniform(key, 0) > .5;
+      double p_thresh = d1 ? params_.p1 : params_.p2;
+      double n_thresh = d1 ? params_.n1 : params_.n2;
+
+      if (uniform(key, 1) < p_thresh) {
+        point.failures_++;
       }
 
-      if (failures_ >= n_thresh) {
-        max_children_ = 0;
-        is_terminal_ = true;
-        terminal_depths.push_back(depth_);
+      if (point.failures_ >= n_thresh) {
+        point.max_children_ = 0;
       } else {
-        max_children_ = std::max(1, nb(gen));
-        is_terminal_ = false;
+        int k = std::lower_bound(children_cdf_.begin(), children_cdf_.end(), uniform(key, 2)) -
+          children_cdf_.begin();
+        point.max_children_ = std::max(1, k);
       }
 
-      reward_ = norm(gen);
+      // Box-Muller
+      double u = 1 - uniform(key, 3);
+      point.reward_ = params_.reward_mean + params_.reward_sd * std::sqrt(-2 * std::log(u)) *
+        std::cos(6.283185307179586 * uniform(key, 4));
+      return point;
+    }
+  public:
+    explicit synthetic_tree(const v8_params& params = v8_params(), std::uint64_t seed = 0)
+      : params_(params),
+        seed_(seed)
+    {
+      if (params_.nb_r <= 0 || !(params_.nb_p > 0 && params_.nb_p < 1)) {
+        throw std::invalid_argument("need nb_r > 0 and 0 < nb_p < 1");
+      }
+      double pmf = std::pow(params_.nb_p, params_.nb_r);
+      double total = 0;
+      for (int k = 0; total < 1 - 1e-12 && pmf > 0; k++) {
+        if (children_cdf_.size() == max_cdf_size) {
+          throw std::invalid_argument("nb_p too small, too many children");
+        }
+        if (k > 0) {
+          pmf *= (k + params_.nb_r - 1) * (1 - params_.nb_p) / k;
+        }
+        total += pmf;
+        children_cdf_.push_back(total);
+      }
+      // P(0 children) = nb_p^nb_r underflowed, so the CDF cannot be built
+      // by the recurrence from there
+      if (children_cdf_.empty()) {
+        throw std::invalid_argument("nb_p^nb_r underflows, nb_r too large");
+      }
+    }
+
+    const v8_params& get_params() const {
+      return params_;
+    }
+
+    synthetic_point root() const {
+      return make(mix(seed_), 1, 0);
+    }
+
+    synthetic_point child(const synthetic_point& parent, int index) const {
+      return make(mix(parent.key_ ^ mix(index + 1)), parent.depth_ + 1, parent.failures_);
+    }
+};
+
+// The part of the synthetic tree the search has expanded, with its visit
+// statistics. Everything else about a node comes from its point.
+class node {
+  public:
+
+  private:
+    node* parent_;
+    std::vector<node> children_;
+    synthetic_point point_;
+    double q_;
+    int n_;
+    std::size_t node_id_;
+  public:
+    node(synthetic_point point, node* parent = nullptr)
+      : parent_(parent),
+        point_(point),
+        q_(0), n_(0), node_id_(node_id++)
+    {
     }
 
     std::string to_gv() const {
       std::stringstream ss;
       /*
-      ss << " " << node_id_ << " [label=\"r:" << reward_ << std::endl
+      ss << " " << node_id_ << " [label=\"r:" << get_reward() << std::endl
         << "n:" << n_ << std::endl << "q:" << q_ << "\"]" << std::endl;
       */
 
       ss << " " << node_id_ << " [label=\"ucb1:" << ucb1(this) << std::endl
-        << "max: " << max_children_ << std::endl
+        << "max: " << max_children() << std::endl
         << "n:" << n_ << "\"]" << std::endl;
 
       for (auto& child : children_) {
@@ -97,22 +215,27 @@ class node {
       return ss.str();
     }
 
-    node* expand() {
-      if (num_children() < max_children_) {
-        node child(this);
-        children_.push_back(child);
+    node* expand(const synthetic_tree& tree) {
+      if (num_children() < max_children()) {
+        // children hold a pointer to this node, so they must never move
+        children_.reserve(max_children());
+        children_.emplace_back(tree.child(point_, num_children()), this);
         return &(children_.back());
       } else {
         return nullptr;
       }
     }
 
+    const synthetic_point& get_point() const {
+      return point_;
+    }
+
     int get_failures() const {
-      return failures_;
+      return point_.get_failures();
     }
 
     int get_depth() const {
-      return depth_;
+      return point_.get_depth();
     }
 
     double get_q() const {
@@ -136,11 +259,11 @@ class node {
     }
 
     int max_children() const {
-      return max_children_;
+      return point_.max_children();
     }
 
     double get_reward() const {
-      return reward_;
+      return point_.get_reward();
     }
 
     node* get_parent() const {
@@ -151,8 +274,12 @@ class node {
       return children_;
     }
 
+    const std::vector<node>& get_children() const {
+      return children_;
+    }
+
     bool is_terminal() const {
-      return is_terminal_;
+      return point_.is_terminal();
     }
 
     bool has_children() const {
@@ -165,16 +292,33 @@ class mcts {
   public:
 
   private:
+    synthetic_tree tree_;
     node root_;
     node* cur_;
     std::size_t num_nodes_;
+    int max_depth_ = 1;
+    std::mt19937 gen_;
+    std::uniform_real_distribution<> dis_{0.0, 1.0};
+    // terminal nodes in the tree, by depth
+    std::vector<std::size_t> terminal_depths_;
+
+    void record_terminal(int depth) {
+      if ((int) terminal_depths_.size() <= depth) {
+        terminal_depths_.resize(depth + 1);
+      }
+      terminal_depths_[depth]++;
+    }
   public:
-    mcts()
-      : root_(node{}),
+    // The tree is fixed by params and tree_seed, the search's own choices
+    // by search_seed, so a run can be repeated exactly.
+    mcts(const v8_params& params = v8_params(), std::uint64_t tree_seed = std::random_device{}(),
+        unsigned search_seed = std::random_device{}())
+      : tree_(params, tree_seed),
+        root_(tree_.root()),
         cur_(&root_),
-        num_nodes_(0)
+        num_nodes_(0),
+        gen_(search_seed)
     {
-      srand(time(NULL));
     }
 
     std::string to_gv() const {
@@ -185,16 +329,19 @@ class mcts {
       return ss.str();
     }
 
-    std::vector<int>& get_terminal_depths() {
-      return terminal_depths;
+    // how many terminal nodes the tree has at each depth. Rollouts build
+    // no nodes and are not counted; the original v8 built a node for every
+    // rollout step, so its histogram counted their terminals as well.
+    const std::vector<std::size_t>& get_terminal_depths() const {
+      return terminal_depths_;
     }
 
     node* best_child(node* parent) {
       auto& children = parent->get_children();
 
       // epsilon greedy
-      if (dis(gen) < .3) {
-        return &(children[std::rand() % children.size()]);
+      if (dis_(gen_) < .3) {
+        return &(children[gen_() % children.size()]);
       }
 
       double max_score = -std::numeric_limits<double>::max();
@@ -214,14 +361,18 @@ class mcts {
           best.push_back(&child);
         }
       }
-      return best[std::rand() % best.size()];
+      return best[gen_() % best.size()];
     }
 
     node* tree_policy(node* cur) {
       while (!cur->is_terminal()) {
-        node* exp = cur->expand();
+        node* exp = cur->expand(tree_);
         if (exp) {
           num_nodes_++;
+          max_depth_ = std::max(max_depth_, exp->get_depth());
+          if (exp->is_terminal()) {
+            record_terminal(exp->get_depth());
+          }
           return exp;
         }
         if (cur->has_children()) {
@@ -231,22 +382,19 @@ class mcts {
       return cur;
     }
 
+    // Walks the implicit tree below base to a terminal, one uniformly
+    // chosen child at a time, without building any node.
     double default_policy(node* base) {
-      node* cur = base;
-      bool did_expand = false;
-
-      while (cur && !cur->is_terminal()) {
-        cur = cur->expand();
-        did_expand = true;
+      synthetic_point cur = base->get_point();
+      if (cur.is_terminal()) {
+        return cur.get_reward();
       }
 
-      double reward = cur->get_reward();
-
-      if (did_expand) {
-        base->get_children().pop_back();
+      while (!cur.is_terminal()) {
+        cur = tree_.child(cur, gen_() % cur.max_children());
       }
 
-      return reward;
+      return cur.get_reward();
     }
 
     void backprop(node* cur, double q) {
@@ -258,12 +406,30 @@ class mcts {
     }
 
 
-    void search_aio(int iterations) {
+    // nodes added to the tree, the root excluded
+    std::size_t get_num_nodes() const {
+      return num_nodes_;
+    }
+
+    // depth of the deepest node in the tree, the root being 1
+    int get_max_depth() const {
+      return max_depth_;
+    }
+
+    const node& get_root() const {
+      return root_;
+    }
+
+    void search(std::size_t iterations) {
       for (std::size_t i = 0; i < iterations; i++) {
         node* leaf = tree_policy(cur_);
         double reward = default_policy(leaf);
         backprop(leaf, reward);
       }
+    }
+
+    void search_aio(std::size_t iterations) {
+      search(iterations);
       std::cout << "num_node: " << num_nodes_ << std::endl;
     }
 
@@ -0,0 +1,220 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "v8.hpp"
+
+// Runs v8's MCTS over a grid of tree parameters x seeds x iteration
+// budgets, one run per core at a time, and writes one CSV row of
+// aggregate metrics per run. Each argument sets one parameter to a comma
+// separated list of values; the grid is every combination of them, with
+// v8's defaults for the rest. A run's tree and search are both seeded
+// from its seed, so a row can be reproduced on its own. The tree_terminal
+// columns describe the terminal nodes of the search tree; rollouts are
+// not counted, unlike the depth histogram of the original v8.
+//
+//   v8_sweep [p1=0.4,...] [p2=] [n1=] [n2=] [nb_r=] [nb_p=] [reward_mean=] [reward_sd=]
+//            [seeds=1] [iterations=1e5,...] [threads=all] [csv=-]
+
+struct sweep_job {
+  v8_params params;
+  unsigned seed;
+  std::size_t iterations;
+};
+
+struct sweep_result {
+  std::size_t num_nodes = 0;
+  int max_depth = 0;
+  // terminal nodes in the search tree only, not those rollouts reached
+  std::size_t num_terminals = 0;
+  double terminal_depth_mean = 0;
+  double terminal_depth_var = 0;
+  // mean return at the root, and of the most visited root child
+  double root_mean = 0;
+  double best_mean = 0;
+  int best_visits = 0;
+  int root_children = 0;
+  double seconds = 0;
+};
+
+static std::vector<double> parse_list(const std::string& values) {
+  std::vector<double> list;
+  std::stringstream ss(values);
+  std::string value;
+  while (std::getline(ss, value, ',')) {
+    list.push_back(std::stod(value));
+  }
+  if (list.empty()) {
+    throw std::invalid_argument("no values");
+  }
+  return list;
+}
+
+static sweep_result run(const sweep_job& job) {
+  auto start = std::chrono::steady_clock::now();
+  mcts m(job.params, job.seed, job.seed);
+  m.search(job.iterations);
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  sweep_result res;
+  res.seconds = elapsed.count();
+  res.num_nodes = m.get_num_nodes();
+  res.max_depth = m.get_max_depth();
+
+  auto& depths = m.get_terminal_depths();
+  double sum = 0;
+  for (std::size_t d = 0; d < depths.size(); d++) {
+    res.num_terminals += depths[d];
+    sum += double(d) * depths[d];
+  }
+  if (res.num_terminals) {
+    res.terminal_depth_mean = sum / res.num_terminals;
+    for (std::size_t d = 0; d < depths.size(); d++) {
+      double delta = d - res.terminal_depth_mean;
+      res.terminal_depth_var += delta * delta * depths[d];
+    }
+    res.terminal_depth_var /= res.num_terminals;
+  }
+
+  const node& root = m.get_root();
+  if (root.get_n()) {
+    res.root_mean = root.get_q() / root.get_n();
+  }
+  res.root_children = root.num_children();
+  for (auto& child : root.get_children()) {
+    if (child.get_n() > res.best_visits) {
+      res.best_visits = child.get_n();
+      res.best_mean = child.get_q() / child.get_n();
+    }
+  }
+  return res;
+}
+
+int main(int argc, char** argv) {
+  v8_params defaults;
+  using setter = std::function<void(v8_params&, double)>;
+  std::vector<std::pair<std::string, setter>> fields = {
+    {"p1", [](v8_params& p, double v) { p.p1 = v; }},
+    {"p2", [](v8_params& p, double v) { p.p2 = v; }},
+    {"n1", [](v8_params& p, double v) { p.n1 = v; }},
+    {"n2", [](v8_params& p, double v) { p.n2 = v; }},
+    {"nb_r", [](v8_params& p, double v) { p.nb_r = v; }},
+    {"nb_p", [](v8_params& p, double v) { p.nb_p = v; }},
+    {"reward_mean", [](v8_params& p, double v) { p.reward_mean = v; }},
+    {"reward_sd", [](v8_params& p, double v) { p.reward_sd = v; }},
+  };
+  std::map<std::string, std::vector<double>> grid = {
+    {"p1", {defaults.p1}}, {"p2", {defaults.p2}}, {"n1", {double(defaults.n1)}},
+    {"n2", {double(defaults.n2)}}, {"nb_r", {double(defaults.nb_r)}}, {"nb_p", {defaults.nb_p}},
+    {"reward_mean", {defaults.reward_mean}}, {"reward_sd", {defaults.reward_sd}},
+    {"seeds", {1}}, {"iterations", {1e5}},
+  };
+  unsigned num_threads = std::thread::hardware_concurrency();
+  std::string csv_path = "-";
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    std::size_t eq = arg.find('=');
+    std::string key = arg.substr(0, eq);
+    try {
+      if (eq == std::string::npos) {
+        throw std::invalid_argument("expected key=values");
+      } else if (key == "threads") {
+        num_threads = std::stoul(arg.substr(eq + 1));
+      } else if (key == "csv") {
+        csv_path = arg.substr(eq + 1);
+      } else if (grid.count(key)) {
+        grid[key] = parse_list(arg.substr(eq + 1));
+      } else {
+        throw std::invalid_argument("unknown parameter");
+      }
+    } catch (const std::exception& e) {
+      std::cerr << "bad argument " << arg << ": " << e.what() << std::endl;
+      return 1;
+    }
+  }
+  num_threads = std::max(1u, num_threads);
+
+  // every combination, parameters first, iterations varying fastest
+  std::vector<sweep_job> jobs{sweep_job{defaults, 0, 0}};
+  auto expand = [&](const std::vector<double>& values, std::function<void(sweep_job&, double)> set) {
+    std::vector<sweep_job> next;
+    for (auto& job : jobs) {
+      for (double value : values) {
+        sweep_job copy = job;
+        set(copy, value);
+        next.push_back(copy);
+      }
+    }
+    jobs.swap(next);
+  };
+  for (auto& field : fields) {
+    setter set = field.second;
+    expand(grid[field.first], [set](sweep_job& job, double v) { set(job.params, v); });
+  }
+  std::vector<double> seeds;
+  for (int s = 1; s <= grid["seeds"][0]; s++) {
+    seeds.push_back(s);
+  }
+  expand(seeds, [](sweep_job& job, double v) { job.seed = v; });
+  expand(grid["iterations"], [](sweep_job& job, double v) { job.iterations = v; });
+
+  for (auto& job : jobs) {
+    try {
+      synthetic_tree check(job.params);
+    } catch (const std::exception& e) {
+      std::cerr << "bad parameters nb_r=" << job.params.nb_r << " nb_p=" << job.params.nb_p
+        << ": " << e.what() << std::endl;
+      return 1;
+    }
+  }
+
+  std::ofstream csv_file;
+  if (csv_path != "-") {
+    csv_file.open(csv_path);
+    if (!csv_file) {
+      std::cerr << "cannot write " << csv_path << std::endl;
+      return 1;
+    }
+  }
+  std::ostream& csv = csv_path == "-" ? std::cout : csv_file;
+
+  std::vector<sweep_result> results(jobs.size());
+  std::atomic<std::size_t> next(0);
+  std::vector<std::thread> workers;
+  for (unsigned t = 0; t < num_threads; t++) {
+    workers.emplace_back([&]() {
+      for (std::size_t i = next++; i < jobs.size(); i = next++) {
+        results[i] = run(jobs[i]);
+        std::cerr << "." << std::flush;
+      }
+    });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  std::cerr << std::endl;
+
+  csv << "p1,p2,n1,n2,nb_r,nb_p,reward_mean,reward_sd,seed,iterations,num_nodes,max_depth,"
+    << "tree_terminals,tree_terminal_depth_mean,tree_terminal_depth_var,root_mean,best_mean,best_visits,"
+    << "root_children,seconds" << std::endl;
+  for (std::size_t i = 0; i < jobs.size(); i++) {
+    const v8_params& p = jobs[i].params;
+    const sweep_result& res = results[i];
+    csv << p.p1 << "," << p.p2 << "," << p.n1 << "," << p.n2 << "," << p.nb_r << "," << p.nb_p << ","
+      << p.reward_mean << "," << p.reward_sd << "," << jobs[i].seed << "," << jobs[i].iterations << ","
+      << res.num_nodes << "," << res.max_depth << "," << res.num_terminals << ","
+      << res.terminal_depth_mean << "," << res.terminal_depth_var << "," << res.root_mean << ","
+      << res.best_mean << "," << res.best_visits << "," << res.root_children << ","
+      << res.seconds << std::endl;
+  }
+  std::cerr << jobs.size() << " runs, " << num_threads << " threads" << std::endl;
+}